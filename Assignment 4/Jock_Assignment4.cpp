@@ -1,37 +1,214 @@
 #include <iostream>
 #include <vector>
 #include <string>
-#include <map>
 #include <unordered_map>
 #include <variant>
 #include <cstdint>
 #include <bitset>
 #include <limits>
+#include <functional>
+#include <cstring>
+#include <cassert>
+
+#include "host_profile.h"
 
 //====ASSIGNMENT 2====
 
 const int STALL_INT = 10;       // Stall for integer instructions = 1 CPU cycle = 10 sim ticks
 const int STALL_FLOAT = 50;     // Stall for floating point instructions = 5 CPU cycles = 50 sim ticks
+const int CPU_CYCLE_TICKS = 10; // Sim ticks per CPU cycle
 
-struct Event
+const int MEMORY_SIZE = 1024;   // Bytes of data memory, one double per 8 bytes
+const int NUM_REGISTERS = 32;
+
+enum Stage
 {
-    std::string name;
-    std::string stage;
-    int cycle;
+    FETCH,
+    DECODE,
+    EXECUTE,
+    STORE,
+    NUM_STAGES
+};
+
+const char* const pipeline_stages[NUM_STAGES] = {"Fetch", "Decode", "Execute", "Store"};
+const char* const stage_actions[NUM_STAGES] = {"Fetching", "Decoding", "Executing", "Storing"};
+
+enum Opcode
+{
+    OP_FLD,
+    OP_FSD,
+    OP_FADD_D,
+    OP_FSUB_D,
+    OP_FMUL_D,
+    OP_FDIV_D,
+    OP_ADDI,
+    OP_BNE,
+    OP_OTHER
 };
 
+// Static instruction: what load_instructions puts in the program. The operand text is parsed
+// once here so executing it only indexes the register files.
 struct Instruction
 {
     std::string name;
     std::vector<std::string> operands;
     std::string type;
-    std::string stage;
+    Opcode opcode;
+    int rd;                 // Destination register, or the data register of fsd
+    int rs1;                // First source, or the base register of fld / fsd
+    int rs2;
+    int imm;                // addi immediate or fld / fsd offset
+    int extra_stall;        // Cycles the Store stage holds the pipeline after this instruction
+
+    Instruction(std::string n, std::vector<std::string> ops, std::string t)
+        : name(n), operands(ops), type(t), opcode(OP_OTHER), rd(0), rs1(0), rs2(0), imm(0), extra_stall(0)
+    {
+        static const std::unordered_map<std::string, Opcode> opcodes = {
+            {"fld", OP_FLD}, {"fsd", OP_FSD}, {"fadd.d", OP_FADD_D}, {"fsub.d", OP_FSUB_D},
+            {"fmul.d", OP_FMUL_D}, {"fdiv.d", OP_FDIV_D}, {"addi", OP_ADDI}, {"bne", OP_BNE}};
+        auto it = opcodes.find(name);
+        if (it != opcodes.end())
+        {
+            opcode = it->second;
+        }
+
+        switch (opcode)
+        {
+            case OP_FLD:
+            case OP_FSD:
+                rd = parse_register(operands[0]);
+                imm = std::stoi(operands[1].substr(0, operands[1].find('(')));
+                rs1 = parse_register(operands[1].substr(operands[1].find('(') + 1));
+                break;
+            case OP_FADD_D:
+            case OP_FSUB_D:
+            case OP_FMUL_D:
+            case OP_FDIV_D:
+                rd = parse_register(operands[0]);
+                rs1 = parse_register(operands[1]);
+                rs2 = parse_register(operands[2]);
+                break;
+            case OP_ADDI:
+                rd = parse_register(operands[0]);
+                rs1 = parse_register(operands[1]);
+                imm = std::stoi(operands[2]);
+                break;
+            case OP_BNE:
+                rs1 = parse_register(operands[0]);
+                rs2 = parse_register(operands[1]);
+                break;
+            case OP_OTHER:
+                break;
+        }
+
+        // FP results other than stores take an extra cycle, the arithmetic ones two
+        if (type == "F" && opcode != OP_FSD)
+        {
+            extra_stall = (opcode == OP_FADD_D || opcode == OP_FSUB_D || opcode == OP_FMUL_D || opcode == OP_FDIV_D) ? 2 : 1;
+        }
+    }
+
+    // "x5" / "f4" (any trailing text such as ')' is ignored) -> 5 / 4
+    static int parse_register(const std::string& text)
+    {
+        int number = std::stoi(text.substr(1));
+        assert(number >= 0 && number < NUM_REGISTERS);
+        return number;
+    }
+};
+
+// Dynamic instruction: one execution of a static instruction while it is in flight
+struct DynamicInstruction
+{
+    const Instruction* static_instr;
+    uint64_t seq;                       // Program order of this execution
+    Stage stage;
     double data;
-    std::map<std::string, int> cycle_entered;
-    Instruction(std::string n, std::vector<std::string> ops, std::string t) : name(n), operands(ops), type(t), stage("Fetch"), data(0.0) {}
+    int cycle_entered[NUM_STAGES];      // Cycle each stage was entered, -1 if not (yet)
 };
 
-const std::vector<std::string> pipeline_stages = {"Fetch", "Decode", "Execute", "Store"};
+struct Event
+{
+    const DynamicInstruction* instr;
+    Stage stage;
+    int cycle;
+};
+
+// Fixed-capacity ring of dynamic instruction records. Instructions are fetched and retired in
+// program order, so records are handed out at the tail and recycled from the head (or from the
+// tail when a flush squashes the youngest ones); the pipeline loop never touches the heap.
+class InstructionPool
+{
+    private:
+        static const int CAPACITY = 8;      // Pipeline depth plus headroom
+        DynamicInstruction records[CAPACITY];
+        int head;
+        int count;
+        uint64_t next_seq;
+
+    public:
+        InstructionPool() : head(0), count(0), next_seq(0) {}
+
+        // Take a record for the next execution of instr; nullptr if every record is in flight
+        DynamicInstruction* allocate(const Instruction* instr)
+        {
+            if (count == CAPACITY)
+            {
+                return nullptr;
+            }
+            DynamicInstruction* record = &records[(head + count) % CAPACITY];
+            count++;
+            record->static_instr = instr;
+            record->seq = next_seq++;
+            record->stage = FETCH;
+            record->data = 0.0;
+            for (int stage = 0; stage < NUM_STAGES; stage++)
+            {
+                record->cycle_entered[stage] = -1;
+            }
+            return record;
+        }
+
+        // Recycle the oldest record; records retire in program order
+        void retire(const DynamicInstruction* record)
+        {
+            assert(count > 0 && record == &records[head]);
+            head = (head + 1) % CAPACITY;
+            count--;
+        }
+
+        // Recycle the youngest record; a flush squashes youngest first
+        void squash(const DynamicInstruction* record)
+        {
+            assert(count > 0 && record == &records[(head + count - 1) % CAPACITY]);
+            count--;
+        }
+
+        int in_flight() const
+        {
+            return count;
+        }
+};
+
+class Simulator;
+
+// Hooks into a running Simulator; override what you need. The simulator itself prints nothing
+// per cycle, so an unobserved run only pays for an empty loop at each hook.
+class PipelineObserver
+{
+    public:
+        virtual ~PipelineObserver() {}
+        virtual void on_cycle_begin(const Simulator&) {}
+        // instr entered stage this cycle
+        virtual void on_stage(const Simulator&, const DynamicInstruction&, Stage) {}
+        // stage did nothing this cycle; detail is nullptr or says why
+        virtual void on_stall(const Simulator&, Stage, const char*) {}
+        // instr left the pipeline
+        virtual void on_retire(const Simulator&, const DynamicInstruction&) {}
+        // instr read or wrote the data memory word at address
+        virtual void on_memory(const Simulator&, const DynamicInstruction&, int, double, bool) {}
+        virtual void on_cycle_end(const Simulator&) {}
+};
 
 class Simulator
 {
@@ -40,147 +217,227 @@ class Simulator
         const int clock_cycle_limit;
         int pc;                                                     // Program counter
         std::vector<Event> event_list;
-        std::map<std::string, Instruction*> pipeline_registers;
-        std::vector<Instruction*> instructions;
-        std::map<std::string, int> registers;
-        std::map<std::string, double> f_registers;
-        std::map<int, double> memory;
+        DynamicInstruction* pipeline_registers[NUM_STAGES];
+        std::vector<Instruction> instructions;
+        InstructionPool pool;
+        int registers[NUM_REGISTERS] = {};
+        double f_registers[NUM_REGISTERS] = {};
+        std::bitset<NUM_REGISTERS> live_registers;      // Integer registers set or used, for the report
+        std::bitset<NUM_REGISTERS> live_f_registers;
+        std::vector<double> memory;
         bool halt;
         int stall_count;
         bool branch_pred = false;
+        bool finished = false;
+        std::vector<PipelineObserver*> observers;
+        bool observed = false;                      // Observers attached; latched once per cycle
+        const Instruction* watch_instr = nullptr;   // run_until_pc waits for this one to reach Store
+        bool watch_hit = false;
 
     public:
-        Simulator(int num_runs=0) : clock_cycle(0), clock_cycle_limit(num_runs), pc(0), halt(false), stall_count(0)
-        {
-            pipeline_registers["Fetch"] = nullptr;
-            pipeline_registers["Decode"] = nullptr;
-            pipeline_registers["Execute"] = nullptr;
-            pipeline_registers["Store"] = nullptr;
-            registers["x1"] = 160;
-            registers["x2"] = 0;
-            f_registers["f0"] = 0.0;
-            f_registers["f2"] = 0.0;
-            f_registers["f4"] = 0.0;
+        Simulator(int num_runs=0) : clock_cycle(0), clock_cycle_limit(num_runs), pc(0), memory(MEMORY_SIZE / 8, 0.0), halt(false), stall_count(0)
+        {
+            for (int stage = 0; stage < NUM_STAGES; stage++)
+            {
+                pipeline_registers[stage] = nullptr;
+            }
+            event_list.reserve(2 * NUM_STAGES);     // At most one event per in-flight instruction
+            registers[1] = 160;
             load_instructions();
+            for (const Instruction& instr : instructions)
+            {
+                mark_live(instr);
+            }
         }
 
+        template <bool Timed>
         void fetch()
         {
+            TimedPhaseScope<Timed> host_phase(PHASE_FETCH);
             if (stall_count > 0)
             {
-                std::cout << "Cycle " << clock_cycle << ": Fetch stage is stalled." << std::endl;
+                notify_stall<Timed>(FETCH, nullptr);
                 return;
             }
 
-            if (pc < instructions.size())
+            if (pc < static_cast<int>(instructions.size()))
             {
-                Instruction* instr = instructions[pc];
+                DynamicInstruction* instr = pool.allocate(&instructions[pc]);
+                if (!instr)
+                {
+                    pipeline_registers[FETCH] = nullptr;
+                    notify_stall<Timed>(FETCH, "no free instruction records");
+                    return;
+                }
                 pc++;
-                instr->stage = "Fetch";
-                instr->cycle_entered["Fetch"] = clock_cycle;
-                pipeline_registers["Fetch"] = instr;
-                event_list.push_back({instr->name, "Fetch", clock_cycle});
-                std::cout << "Cycle " << clock_cycle << ": Fetching instruction " << instr->name << std::endl;
+                enter_stage<Timed>(instr, FETCH);
             }
             else
             {
-                pipeline_registers["Fetch"] = nullptr;      // If no more instructions, set fetch stage to null
+                pipeline_registers[FETCH] = nullptr;        // If no more instructions, set fetch stage to null
             }
             pc = pc % instructions.size();
         }
 
+        template <bool Timed>
         void decode()
         {
+            TimedPhaseScope<Timed> host_phase(PHASE_DECODE);
             if (stall_count > 0)
             {
-                std::cout << "Cycle " << clock_cycle << ": Decode stage is stalled." << std::endl;
+                notify_stall<Timed>(DECODE, nullptr);
                 return;
             }
 
-            Instruction* instr = pipeline_registers["Fetch"];
+            DynamicInstruction* instr = pipeline_registers[FETCH];
             if (instr)
             {
-                clean_event_list(instr);
-                instr->stage = "Decode";
-                instr->cycle_entered["Decode"] = clock_cycle;
-                pipeline_registers["Decode"] = instr;
-                event_list.push_back({instr->name, "Decode", clock_cycle});
-                std::cout << "Cycle " << clock_cycle << ": Decoding instruction " << instr->name << std::endl;
+                enter_stage<Timed>(instr, DECODE);
             }
             else
             {
-                pipeline_registers["Decode"] = nullptr;     // If no instruction in the fetch stage, set decode stage to null
+                pipeline_registers[DECODE] = nullptr;       // If no instruction in the fetch stage, set decode stage to null
             }
         }
 
+        template <bool Timed>
         void execute()
         {
+            TimedPhaseScope<Timed> host_phase(PHASE_EXECUTE);
             if (stall_count > 0)
             {
-                std::cout << "Cycle " << clock_cycle << ": Execute stage is stalled." << std::endl;
+                notify_stall<Timed>(EXECUTE, nullptr);
                 return;
             }
 
-            Instruction* instr = pipeline_registers["Decode"];
+            DynamicInstruction* instr = pipeline_registers[DECODE];
             if (instr)
             {
-                clean_event_list(instr);
-                instr->stage = "Execute";
-                instr->cycle_entered["Execute"] = clock_cycle;
-                pipeline_registers["Execute"] = instr;
-                event_list.push_back({instr->name, "Execute", clock_cycle});
-                std::cout << "Cycle " << clock_cycle << ": Executing instruction " << instr->name << std::endl;
-                pipeline_registers["Decode"] = nullptr;
+                enter_stage<Timed>(instr, EXECUTE);
+                pipeline_registers[DECODE] = nullptr;
             }
             else
             {
-                pipeline_registers["Execute"] = nullptr;   // If no instruction in the decode stage, set execute stage to null
+                pipeline_registers[EXECUTE] = nullptr;     // If no instruction in the decode stage, set execute stage to null
             }
         }
 
+        template <bool Timed>
         void store()
         {
-            Instruction* instr = pipeline_registers["Execute"];
+            TimedPhaseScope<Timed> host_phase(PHASE_WRITEBACK);
+            retire<Timed>(pipeline_registers[STORE]);     // Last cycle's instruction leaves the pipeline
+
+            DynamicInstruction* instr = pipeline_registers[EXECUTE];
             if (instr)
             {
-                clean_event_list(instr);
-                if (instr->type == "F" && instr->name != "fsd")
+                const Instruction* static_instr = instr->static_instr;
+                stall_count += static_instr->extra_stall;
+
+                enter_stage<Timed>(instr, STORE);
+                if (static_instr == watch_instr)
                 {
-                    if (instr->name == "fadd.d" || instr->name == "fsub.d" || instr->name == "fmul.d" || instr->name == "fdiv.d")
-                    {
-                        stall_count++;
-                    }
-                    stall_count++;
+                    watch_hit = true;
                 }
-
-                instr->stage = "Store";
-                instr->cycle_entered["Store"] = clock_cycle;
-                pipeline_registers["Store"] = instr;
-                event_list.push_back({instr->name, "Store", clock_cycle});
-                std::cout << "Cycle " << clock_cycle << ": Storing instruction " << instr->name << std::endl;
-                execute_instruction(instr);
-                pipeline_registers["Execute"] = nullptr;
+                execute_instruction<Timed>(instr);
+                pipeline_registers[EXECUTE] = nullptr;
             }
             else
             {
-                pipeline_registers["Store"] = nullptr;    // If no instruction in the execute stage, set store stage to null
+                pipeline_registers[STORE] = nullptr;      // If no instruction in the execute stage, set store stage to null
             }
         }
 
         void load_instructions(std::string prog_call = "")
         {
-            instructions.push_back(new Instruction("fld", {"f0", "0(x1)"}, "F"));           // fld f0, 0(x1)
-            instructions.push_back(new Instruction("fadd.d", {"f4", "f0", "f2"}, "F"));     // fadd.d f4, f0, f2
-            instructions.push_back(new Instruction("fsd", {"f4", "0(x1)"}, "F"));           // fsd f4, 0(x1)
-            instructions.push_back(new Instruction("addi", {"x1", "x1", "-8"}, "I"));       // addi x1, x1, -8
-            instructions.push_back(new Instruction("bne", {"x1", "x2", "Loop"}, "B"));      // bne x1, x2, Loop
+            instructions.push_back(Instruction("fld", {"f0", "0(x1)"}, "F"));           // fld f0, 0(x1)
+            instructions.push_back(Instruction("fadd.d", {"f4", "f0", "f2"}, "F"));     // fadd.d f4, f0, f2
+            instructions.push_back(Instruction("fsd", {"f4", "0(x1)"}, "F"));           // fsd f4, 0(x1)
+            instructions.push_back(Instruction("addi", {"x1", "x1", "-8"}, "I"));       // addi x1, x1, -8
+            instructions.push_back(Instruction("bne", {"x1", "x2", "Loop"}, "B"));      // bne x1, x2, Loop
         }
 
-        void clean_event_list(Instruction* instr)
+        // Registers the program names show up in the register report
+        void mark_live(const Instruction& instr)
+        {
+            switch (instr.opcode)
+            {
+                case OP_FLD:
+                case OP_FSD:
+                    live_f_registers.set(instr.rd);
+                    live_registers.set(instr.rs1);
+                    break;
+                case OP_FADD_D:
+                case OP_FSUB_D:
+                case OP_FMUL_D:
+                case OP_FDIV_D:
+                    live_f_registers.set(instr.rd).set(instr.rs1).set(instr.rs2);
+                    break;
+                case OP_ADDI:
+                    live_registers.set(instr.rd).set(instr.rs1);
+                    break;
+                case OP_BNE:
+                    live_registers.set(instr.rs1).set(instr.rs2);
+                    break;
+                case OP_OTHER:
+                    break;
+            }
+        }
+
+        // Move instr into a stage: replace its event for the previous stage and stamp the cycle
+        template <bool Timed>
+        void enter_stage(DynamicInstruction* instr, Stage stage)
+        {
+            clean_event_list(instr);
+            instr->stage = stage;
+            instr->cycle_entered[stage] = clock_cycle;
+            pipeline_registers[stage] = instr;
+            event_list.push_back({instr, stage, clock_cycle});
+            if (!observed)
+            {
+                return;
+            }
+            TimedPhaseScope<Timed> logging(PHASE_LOGGING);
+            for (PipelineObserver* observer : observers)
+            {
+                observer->on_stage(*this, *instr, stage);
+            }
+        }
+
+        template <bool Timed>
+        void notify_stall(Stage stage, const char* detail)
+        {
+            if (!observed)
+            {
+                return;
+            }
+            TimedPhaseScope<Timed> logging(PHASE_LOGGING);
+            for (PipelineObserver* observer : observers)
+            {
+                observer->on_stall(*this, stage, detail);
+            }
+        }
+
+        template <bool Timed>
+        void notify_memory(const DynamicInstruction* instr, int addr, double value, bool write)
+        {
+            if (!observed)
+            {
+                return;
+            }
+            TimedPhaseScope<Timed> logging(PHASE_LOGGING);
+            for (PipelineObserver* observer : observers)
+            {
+                observer->on_memory(*this, *instr, addr, value, write);
+            }
+        }
+
+        // Drop the events of this execution only; other executions of the same instruction may be in flight
+        void clean_event_list(const DynamicInstruction* instr)
         {
             for (auto it = event_list.begin(); it != event_list.end();)
             {
-                if (it->name == instr->name && it->stage == instr->stage)
+                if (it->instr == instr)
                 {
                     it = event_list.erase(it);
                 }
@@ -191,83 +448,126 @@ class Simulator
             }
         }
 
-        void execute_instruction(Instruction* instr)
+        // Instruction leaves the Store stage: forget its events and recycle its record
+        template <bool Timed>
+        void retire(DynamicInstruction* instr)
         {
-            std::string name = instr->name;
-            if (name == "fld")
-            {
-                int offset = std::stoi(instr->operands[1].substr(0, instr->operands[1].find('(')));
-                std::string reg = instr->operands[1].substr(instr->operands[1].find('(') + 1);
-                reg = reg.substr(0, reg.find(')'));
-                int addr = registers[reg] + offset;
-                f_registers[instr->operands[0]] = memory[addr];
-                instr->data = f_registers[instr->operands[0]];
-            }
-            else if (name == "fadd.d")
-            {
-                f_registers[instr->operands[0]] = f_registers[instr->operands[1]] + f_registers[instr->operands[2]];
-                instr->data = f_registers[instr->operands[0]];
-            }
-            else if (name == "fsd")
+            if (instr)
             {
-                int offset = std::stoi(instr->operands[1].substr(0, instr->operands[1].find('(')));
-                std::string reg = instr->operands[1].substr(instr->operands[1].find('(') + 1);
-                reg = reg.substr(0, reg.find(')'));
-                int addr = registers[reg] + offset;
-                memory[addr] = f_registers[instr->operands[0]];
-                instr->data = f_registers[instr->operands[0]];
+                if (observed)
+                {
+                    TimedPhaseScope<Timed> logging(PHASE_LOGGING);
+                    for (PipelineObserver* observer : observers)
+                    {
+                        observer->on_retire(*this, *instr);
+                    }
+                }
+                clean_event_list(instr);
+                pool.retire(instr);
+                pipeline_registers[STORE] = nullptr;
             }
-            else if (name == "addi")
+        }
+
+        // Data memory word at a byte address, nullptr (and halt) when out of range
+        template <bool Timed>
+        double* memory_word(int addr)
+        {
+            TimedPhaseScope<Timed> host_phase(PHASE_MEMORY);
+            if (addr < 0 || addr >= MEMORY_SIZE)
             {
-                registers[instr->operands[0]] = registers[instr->operands[1]] + std::stoi(instr->operands[2]);
-                instr->data = registers[instr->operands[0]];
+                std::cout << "Cycle " << clock_cycle << ": Memory access out of range at address " << addr << std::endl;
+                halt = true;
+                return nullptr;
             }
-            else if (name == "bne")
+            return &memory[addr / 8];
+        }
+
+        template <bool Timed>
+        void execute_instruction(DynamicInstruction* instr)
+        {
+            TimedPhaseScope<Timed> host_phase(PHASE_EXECUTE);
+            const Instruction* static_instr = instr->static_instr;
+            switch (static_instr->opcode)
             {
-                if(registers[instr->operands[0]] != registers[instr->operands[1]])
+                case OP_FLD:
                 {
-
+                    int addr = registers[static_instr->rs1] + static_instr->imm;
+                    double* word = memory_word<Timed>(addr);
+                    f_registers[static_instr->rd] = word ? *word : 0.0;
+                    instr->data = f_registers[static_instr->rd];
+                    if (word)
+                    {
+                        notify_memory<Timed>(instr, addr, *word, false);
+                    }
+                    break;
                 }
-                else
+                case OP_FADD_D:
+                    f_registers[static_instr->rd] = f_registers[static_instr->rs1] + f_registers[static_instr->rs2];
+                    instr->data = f_registers[static_instr->rd];
+                    break;
+                case OP_FSD:
                 {
-                    halt = true;
+                    int addr = registers[static_instr->rs1] + static_instr->imm;
+                    double* word = memory_word<Timed>(addr);
+                    if (word)
+                    {
+                        *word = f_registers[static_instr->rd];
+                        notify_memory<Timed>(instr, addr, *word, true);
+                    }
+                    instr->data = f_registers[static_instr->rd];
+                    break;
                 }
-            }
-            else
-            {
-                // Handle other instructions if necessary
+                case OP_ADDI:
+                    registers[static_instr->rd] = registers[static_instr->rs1] + static_instr->imm;
+                    instr->data = registers[static_instr->rd];
+                    break;
+                case OP_BNE:
+                    if (registers[static_instr->rs1] == registers[static_instr->rs2])
+                    {
+                        halt = true;
+                    }
+                    break;
+                default:
+                    // Handle other instructions if necessary
+                    break;
             }
         }
 
+        // Squash everything younger than the Store stage, youngest first so the records go back to the pool
         void flush_pipeline()
         {
-            for (auto& stage : pipeline_stages)
+            for (int stage = FETCH; stage < STORE; stage++)
             {
-                if (stage != "Store")
+                DynamicInstruction* instr = pipeline_registers[stage];
+                if (instr && (stage == FETCH || instr != pipeline_registers[stage - 1]))
                 {
-                    pipeline_registers[stage] = nullptr;
+                    clean_event_list(instr);
+                    pool.squash(instr);
                 }
+                pipeline_registers[stage] = nullptr;
             }
         }
 
-        void print_event_list()
+        // In-flight instructions only, tagged with their execution number; CycleReport prints the
+        // assignment's format, which also lists every instruction that has completed
+        void print_event_list() const
         {
             std::cout << '\n'
                       << "Event List at Cycle " << clock_cycle << ":" << std::endl;
             for (auto& event : event_list)
             {
-                std::cout << "Instruction " << event.name << " in " << event.stage << " stage at cycle " << event.cycle << std::endl;
+                std::cout << "Instruction " << event.instr->static_instr->name << " #" << event.instr->seq << " in " << pipeline_stages[event.stage] << " stage at cycle " << event.cycle << std::endl;
             }
         }
 
-        void print_instructions()
+        void print_instructions() const
         {
             std::cout << '\n'
                       << "Instructions:" << std::endl;
             for (auto& instr : instructions)
             {
-                std::cout << instr->name << " ";
-                for (auto& op : instr->operands)
+                std::cout << instr.name << " ";
+                for (auto& op : instr.operands)
                 {
                     std::cout << op << " ";
                 }
@@ -275,73 +575,286 @@ class Simulator
             }
         }
 
-        void print_pipeline_registers()
+        void print_pipeline_registers() const
         {
             std::cout << '\n'
                       << "Pipeline Registers:" << std::endl;
-            for (auto& reg : pipeline_registers)
+            for (int stage = 0; stage < NUM_STAGES; stage++)
             {
-                std::cout << reg.first << ": " << reg.second << std::endl;
+                std::cout << pipeline_stages[stage] << ": ";
+                if (pipeline_registers[stage])
+                {
+                    std::cout << pipeline_registers[stage]->static_instr->name << " #" << pipeline_registers[stage]->seq;
+                }
+                std::cout << std::endl;
             }
         }
 
-        void print_registers()
+        void print_registers() const
         {
             std::cout << '\n'
                       << "Registers:" << std::endl;
-            for (auto& reg : registers)
+            for (int reg = 0; reg < NUM_REGISTERS; reg++)
             {
-                std::cout << reg.first << ": " << reg.second << std::endl;
+                if (live_registers[reg])
+                {
+                    std::cout << "x" << reg << ": " << registers[reg] << std::endl;
+                }
             }
         }
 
-        void print_f_registers()
+        void print_f_registers() const
         {
             std::cout << '\n'
                       << "Floating Point Registers:" << std::endl;
-            for (auto& reg : f_registers)
+            for (int reg = 0; reg < NUM_REGISTERS; reg++)
+            {
+                if (live_f_registers[reg])
+                {
+                    std::cout << "f" << reg << ": " << f_registers[reg] << std::endl;
+                }
+            }
+        }
+
+        // Report events to observer (not owned) from the next cycle on
+        void attach(PipelineObserver* observer)
+        {
+            observers.push_back(observer);
+        }
+
+        int cycle() const
+        {
+            return clock_cycle;
+        }
+
+        int ticks() const
+        {
+            return clock_cycle * CPU_CYCLE_TICKS;
+        }
+
+        // The program halted or the cycle limit was reached
+        bool done() const
+        {
+            return finished;
+        }
+
+        // Advance up to n clock cycles; returns how many ran
+        int step(int n = 1)
+        {
+            int ran = 0;
+            while (ran < n && !finished)
+            {
+                advance();
+                ran++;
+            }
+            return ran;
+        }
+
+        // Run until the end of the cycle in which instruction number index reaches the Store stage
+        bool run_until_pc(int index)
+        {
+            if (index < 0 || index >= static_cast<int>(instructions.size()))
+            {
+                return false;
+            }
+            watch_instr = &instructions[index];
+            watch_hit = false;
+            while (!finished && !watch_hit)
+            {
+                advance();
+            }
+            watch_instr = nullptr;
+            return watch_hit;
+        }
+
+        // Run until simulation time reaches tick
+        bool run_until_tick(int tick)
+        {
+            while (!finished && ticks() < tick)
+            {
+                advance();
+            }
+            return ticks() >= tick;
+        }
+
+        // Run until predicate holds at the end of a cycle
+        bool run_until(const std::function<bool(const Simulator&)>& predicate)
+        {
+            while (!finished)
+            {
+                advance();
+                if (predicate(*this))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void run()
+        {
+            while (!finished)
             {
-                std::cout << reg.first << ": " << reg.second << std::endl;
+                advance();
             }
         }
 
-        void run() 
+    private:
+        // The stages and observer calls are instantiated with and without the host phase timers
+        // (-H), so an unprofiled run carries no scopes at all; the choice is made once per cycle
+        void advance()
         {
-            while (!halt || pipeline_registers["Fetch"] || pipeline_registers["Decode"] || pipeline_registers["Execute"] || pipeline_registers["Store"]) {
-                clock_cycle++;
-                std::cout << "--------------------------------------------------" << std::endl;
-                store();
-                execute();
-                decode();
-                fetch();
+            if (HostProfile::enabled)
+            {
+                advance_cycle<true>();
+            }
+            else
+            {
+                advance_cycle<false>();
+            }
+        }
 
-                if (stall_count > 0)
+        // One clock cycle through all stages, back to front
+        template <bool Timed>
+        void advance_cycle()
+        {
+            clock_cycle++;
+            observed = !observers.empty();
+            if (observed)
+            {
+                TimedPhaseScope<Timed> logging(PHASE_LOGGING);
+                for (PipelineObserver* observer : observers)
                 {
-                    stall_count--;
+                    observer->on_cycle_begin(*this);
                 }
+            }
+            store<Timed>();
+            execute<Timed>();
+            decode<Timed>();
+            fetch<Timed>();
+
+            if (stall_count > 0)
+            {
+                stall_count--;
+            }
 
-                print_event_list();
-                print_instructions();
-                //print_pipeline_registers();
-                //print_f_registers();
-                print_registers();
-                if (clock_cycle_limit != 0 && clock_cycle >= clock_cycle_limit)
+            if (observed)
+            {
+                TimedPhaseScope<Timed> logging(PHASE_LOGGING);
+                for (PipelineObserver* observer : observers)
                 {
-                    break;
+                    observer->on_cycle_end(*this);
                 }
-                if (halt)
+            }
+            if (clock_cycle_limit != 0 && clock_cycle >= clock_cycle_limit)
+            {
+                finished = true;
+            }
+            if (halt)
+            {
+                flush_pipeline();
+                finished = true;
+            }
+        }
+};
+
+// The classic trace: what every stage did in each cycle
+class StageTracer : public PipelineObserver
+{
+    public:
+        void on_stage(const Simulator& sim, const DynamicInstruction& instr, Stage stage) override
+        {
+            std::cout << "Cycle " << sim.cycle() << ": " << stage_actions[stage] << " instruction " << instr.static_instr->name << std::endl;
+        }
+
+        void on_stall(const Simulator& sim, Stage stage, const char* detail) override
+        {
+            std::cout << "Cycle " << sim.cycle() << ": " << pipeline_stages[stage] << " stage is stalled";
+            if (detail)
+            {
+                std::cout << ", " << detail;
+            }
+            std::cout << "." << std::endl;
+        }
+};
+
+// Per-cycle dump of the event list, program and registers. The event list is the assignment's:
+// each instruction's latest stage in the order it was entered, and completed instructions keep
+// their Store event, so the list grows by one line per instruction retired.
+class CycleReport : public PipelineObserver
+{
+    private:
+        struct Entry
+        {
+            const DynamicInstruction* instr;    // nullptr once the instruction has completed
+            const std::string* name;
+            Stage stage;
+            int cycle;
+        };
+        std::vector<Entry> events;
+
+    public:
+        void on_cycle_begin(const Simulator&) override
+        {
+            std::cout << "--------------------------------------------------" << std::endl;
+        }
+
+        void on_stage(const Simulator& sim, const DynamicInstruction& instr, Stage stage) override
+        {
+            for (auto it = events.begin(); it != events.end(); ++it)
+            {
+                if (it->instr == &instr)
                 {
-                    flush_pipeline();
+                    events.erase(it);
                     break;
                 }
             }
+            events.push_back({&instr, &instr.static_instr->name, stage, sim.cycle()});
+        }
+
+        void on_retire(const Simulator&, const DynamicInstruction& instr) override
+        {
+            for (Entry& entry : events)
+            {
+                if (entry.instr == &instr)
+                {
+                    entry.instr = nullptr;      // The record is recycled; keep the event itself
+                }
+            }
+        }
+
+        void on_cycle_end(const Simulator& sim) override
+        {
+            std::cout << '\n'
+                      << "Event List at Cycle " << sim.cycle() << ":" << std::endl;
+            for (const Entry& entry : events)
+            {
+                std::cout << "Instruction " << *entry.name << " in " << pipeline_stages[entry.stage] << " stage at cycle " << entry.cycle << std::endl;
+            }
+            sim.print_instructions();
+            //sim.print_pipeline_registers();
+            //sim.print_f_registers();
+            sim.print_registers();
         }
 };
 
-int main()
+int main(int argc, char* argv[])
 {
+    // -H: report where the host time goes when the program exits
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "-H") == 0)
+        {
+            HostProfile::start(true, "the stages instantiated with phase timers, which -H selects");
+        }
+    }
+
     int limit = 0;
     Simulator sim(limit);
+    CycleReport report;
+    StageTracer tracer;
+    sim.attach(&report);
+    sim.attach(&tracer);
     sim.run();
     return 0;
 }
@@ -0,0 +1,920 @@
+// assembler.cpp
+#include "assembler.h"
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string_view>
+
+namespace {
+
+// Operand layouts of the real (non-pseudo) instructions
+enum Format {
+    FMT_R,          // rd, rs1, rs2
+    FMT_I,          // rd, rs1, imm
+    FMT_SHIFT,      // rd, rs1, shamt
+    FMT_LOAD,       // rd, imm(rs1)
+    FMT_STORE,      // rs2, imm(rs1)
+    FMT_BRANCH,     // rs1, rs2, target
+    FMT_U,          // rd, imm20
+    FMT_JAL,        // rd, target
+    FMT_JALR,       // rd, imm(rs1) | rd, rs1, imm
+    FMT_LOAD_FP,    // frd, imm(rs1)
+    FMT_STORE_FP,   // frs2, imm(rs1)
+    FMT_FP_R,       // frd, frs1, frs2 [, rm]
+    FMT_FP_R1,      // frd, frs1 [, rm]
+    FMT_FP_CMP,     // rd, frs1, frs2
+    FMT_FP_TO_INT,  // rd, frs1 [, rm]
+    FMT_INT_TO_FP,  // frd, rs1 [, rm]
+    FMT_FP_R4,      // frd, frs1, frs2, frs3 [, rm]
+    FMT_FENCE,      // [pred, succ]
+    FMT_SYSTEM,     // no operands
+    FMT_LR,         // rd, (rs1)
+    FMT_AMO         // rd, rs2, (rs1)
+};
+
+// funct3 value meaning "optional rounding mode operand, dynamic by default"
+const uint32_t RM_OPERAND = 8;
+
+} // namespace
+
+struct Assembler::OpInfo {
+    Format format;
+    uint32_t opcode;
+    uint32_t funct3;
+    uint32_t funct7;
+    uint32_t rs2;       // Fixed rs2 field (single source FP ops, ecall / ebreak)
+};
+
+namespace {
+
+using OpInfo = Assembler::OpInfo;
+
+// RV32A: funct5 of each instruction. funct7 carries funct5 and the aq / rl ordering bits,
+// so every mnemonic is also added with its .aq, .rl and .aqrl forms.
+const std::pair<const char*, uint32_t> atomicOps[] = {
+    {"lr.w", 0x02}, {"sc.w", 0x03}, {"amoswap.w", 0x01}, {"amoadd.w", 0x00}, {"amoxor.w", 0x04},
+    {"amoand.w", 0x0C}, {"amoor.w", 0x08}, {"amomin.w", 0x10}, {"amomax.w", 0x14}, {"amominu.w", 0x18},
+    {"amomaxu.w", 0x1C},
+};
+
+std::unordered_map<std::string, OpInfo> withAtomics(std::unordered_map<std::string, OpInfo> table) {
+    const std::pair<const char*, uint32_t> orderings[] = {{"", 0}, {".rl", 1}, {".aq", 2}, {".aqrl", 3}};
+    for (const auto& atomic : atomicOps) {
+        Format format = atomic.second == 0x02 ? FMT_LR : FMT_AMO;
+        for (const auto& ordering : orderings) {
+            uint32_t funct7 = atomic.second << 2 | ordering.second;
+            table[std::string(atomic.first) + ordering.first] = {format, 0x2F, 2, funct7, 0};
+        }
+    }
+    return table;
+}
+
+const std::unordered_map<std::string, OpInfo> opcodeTable = withAtomics({
+    {"add",   {FMT_R, 0x33, 0, 0x00, 0}}, {"sub",  {FMT_R, 0x33, 0, 0x20, 0}},
+    {"sll",   {FMT_R, 0x33, 1, 0x00, 0}}, {"slt",  {FMT_R, 0x33, 2, 0x00, 0}},
+    {"sltu",  {FMT_R, 0x33, 3, 0x00, 0}}, {"xor",  {FMT_R, 0x33, 4, 0x00, 0}},
+    {"srl",   {FMT_R, 0x33, 5, 0x00, 0}}, {"sra",  {FMT_R, 0x33, 5, 0x20, 0}},
+    {"or",    {FMT_R, 0x33, 6, 0x00, 0}}, {"and",  {FMT_R, 0x33, 7, 0x00, 0}},
+
+    {"addi",  {FMT_I, 0x13, 0, 0, 0}}, {"slti", {FMT_I, 0x13, 2, 0, 0}},
+    {"sltiu", {FMT_I, 0x13, 3, 0, 0}}, {"xori", {FMT_I, 0x13, 4, 0, 0}},
+    {"ori",   {FMT_I, 0x13, 6, 0, 0}}, {"andi", {FMT_I, 0x13, 7, 0, 0}},
+    {"slli",  {FMT_SHIFT, 0x13, 1, 0x00, 0}}, {"srli", {FMT_SHIFT, 0x13, 5, 0x00, 0}},
+    {"srai",  {FMT_SHIFT, 0x13, 5, 0x20, 0}},
+
+    {"lb",  {FMT_LOAD, 0x03, 0, 0, 0}}, {"lh",  {FMT_LOAD, 0x03, 1, 0, 0}},
+    {"lw",  {FMT_LOAD, 0x03, 2, 0, 0}}, {"lbu", {FMT_LOAD, 0x03, 4, 0, 0}},
+    {"lhu", {FMT_LOAD, 0x03, 5, 0, 0}},
+    {"sb",  {FMT_STORE, 0x23, 0, 0, 0}}, {"sh", {FMT_STORE, 0x23, 1, 0, 0}},
+    {"sw",  {FMT_STORE, 0x23, 2, 0, 0}},
+
+    {"beq",  {FMT_BRANCH, 0x63, 0, 0, 0}}, {"bne",  {FMT_BRANCH, 0x63, 1, 0, 0}},
+    {"blt",  {FMT_BRANCH, 0x63, 4, 0, 0}}, {"bge",  {FMT_BRANCH, 0x63, 5, 0, 0}},
+    {"bltu", {FMT_BRANCH, 0x63, 6, 0, 0}}, {"bgeu", {FMT_BRANCH, 0x63, 7, 0, 0}},
+
+    {"lui",   {FMT_U, 0x37, 0, 0, 0}}, {"auipc", {FMT_U, 0x17, 0, 0, 0}},
+    {"jal",   {FMT_JAL, 0x6F, 0, 0, 0}}, {"jalr", {FMT_JALR, 0x67, 0, 0, 0}},
+
+    {"flw", {FMT_LOAD_FP, 0x07, 2, 0, 0}}, {"fsw", {FMT_STORE_FP, 0x27, 2, 0, 0}},
+
+    {"fadd.s",   {FMT_FP_R, 0x53, RM_OPERAND, 0x00, 0}}, {"fsub.s", {FMT_FP_R, 0x53, RM_OPERAND, 0x04, 0}},
+    {"fmul.s",   {FMT_FP_R, 0x53, RM_OPERAND, 0x08, 0}}, {"fdiv.s", {FMT_FP_R, 0x53, RM_OPERAND, 0x0C, 0}},
+    {"fsgnj.s",  {FMT_FP_R, 0x53, 0, 0x10, 0}}, {"fsgnjn.s", {FMT_FP_R, 0x53, 1, 0x10, 0}},
+    {"fsgnjx.s", {FMT_FP_R, 0x53, 2, 0x10, 0}},
+    {"fmin.s",   {FMT_FP_R, 0x53, 0, 0x14, 0}}, {"fmax.s", {FMT_FP_R, 0x53, 1, 0x14, 0}},
+    {"fsqrt.s",  {FMT_FP_R1, 0x53, RM_OPERAND, 0x2C, 0}},
+    {"feq.s",    {FMT_FP_CMP, 0x53, 2, 0x50, 0}}, {"flt.s", {FMT_FP_CMP, 0x53, 1, 0x50, 0}},
+    {"fle.s",    {FMT_FP_CMP, 0x53, 0, 0x50, 0}},
+    {"fcvt.w.s",  {FMT_FP_TO_INT, 0x53, RM_OPERAND, 0x60, 0}},
+    {"fcvt.wu.s", {FMT_FP_TO_INT, 0x53, RM_OPERAND, 0x60, 1}},
+    {"fmv.x.w",   {FMT_FP_TO_INT, 0x53, 0, 0x70, 0}}, {"fclass.s", {FMT_FP_TO_INT, 0x53, 1, 0x70, 0}},
+    {"fcvt.s.w",  {FMT_INT_TO_FP, 0x53, RM_OPERAND, 0x68, 0}},
+    {"fcvt.s.wu", {FMT_INT_TO_FP, 0x53, RM_OPERAND, 0x68, 1}},
+    {"fmv.w.x",   {FMT_INT_TO_FP, 0x53, 0, 0x78, 0}},
+    {"fmadd.s",  {FMT_FP_R4, 0x43, RM_OPERAND, 0, 0}}, {"fmsub.s",  {FMT_FP_R4, 0x47, RM_OPERAND, 0, 0}},
+    {"fnmsub.s", {FMT_FP_R4, 0x4B, RM_OPERAND, 0, 0}}, {"fnmadd.s", {FMT_FP_R4, 0x4F, RM_OPERAND, 0, 0}},
+
+    {"fence",  {FMT_FENCE, 0x0F, 0, 0, 0}},
+    {"ecall",  {FMT_SYSTEM, 0x73, 0, 0, 0}}, {"ebreak", {FMT_SYSTEM, 0x73, 0, 0, 1}},
+});
+
+// Decimal register index below limit, e.g. the "11" of "s11"; -1 otherwise
+int registerIndex(std::string_view digits, int limit) {
+    if (digits.empty() || digits.size() > 2 || (digits.size() == 2 && digits[0] == '0')) return -1;
+    int index = 0;
+    for (char c : digits) {
+        if (c < '0' || c > '9') return -1;
+        index = index * 10 + (c - '0');
+    }
+    return index < limit ? index : -1;
+}
+
+// x0-x31 or an ABI name (zero, ra, sp, gp, tp, fp, t0-t6, s0-s11, a0-a7); -1 otherwise.
+// Parsed by hand: register operands are the most common token in a program.
+int intRegisterNumber(std::string_view name) {
+    if (name.size() < 2) return -1;
+    std::string_view rest = name.substr(1);
+    int index;
+    switch (name[0]) {
+        case 'x': return registerIndex(rest, 32);
+        case 'a': index = registerIndex(rest, 8); return index < 0 ? -1 : 10 + index;
+        case 't':
+            if (rest == "p") return 4;
+            index = registerIndex(rest, 7);
+            return index < 0 ? -1 : (index < 3 ? 5 + index : 25 + index);
+        case 's':
+            if (rest == "p") return 2;
+            index = registerIndex(rest, 12);
+            return index < 0 ? -1 : (index < 2 ? 8 + index : 16 + index);
+        case 'z': return rest == "ero" ? 0 : -1;
+        case 'r': return rest == "a" ? 1 : -1;
+        case 'g': return rest == "p" ? 3 : -1;
+        case 'f': return rest == "p" ? 8 : -1;
+        default: return -1;
+    }
+}
+
+// f0-f31 or an ABI name (ft0-ft11, fs0-fs11, fa0-fa7); -1 otherwise
+int fpRegisterNumber(std::string_view name) {
+    if (name.size() < 2 || name[0] != 'f') return -1;
+    std::string_view rest = name.substr(2);
+    int index;
+    switch (name[1]) {
+        case 't': index = registerIndex(rest, 12); return index < 0 ? -1 : (index < 8 ? index : 20 + index);
+        case 's': index = registerIndex(rest, 12); return index < 0 ? -1 : (index < 2 ? 8 + index : 16 + index);
+        case 'a': index = registerIndex(rest, 8); return index < 0 ? -1 : 10 + index;
+        default: return registerIndex(name.substr(1), 32);
+    }
+}
+
+const std::unordered_map<std::string, uint32_t> roundingModes = {
+    {"rne", 0}, {"rtz", 1}, {"rdn", 2}, {"rup", 3}, {"rmm", 4}, {"dyn", 7},
+};
+
+// Directives that carry no meaning for a flat memory image
+const char* ignoredDirectives[] = {
+    ".globl", ".global", ".local", ".type", ".size", ".file", ".ident", ".option",
+    ".attribute", ".addrsig", ".addrsig_sym", ".p2alignl", ".weak", ".hidden",
+};
+
+bool isSymbolChar(char c) {
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '.' || c == '$';
+}
+
+// Text before a '#' or "//" comment
+std::string_view stripComment(std::string_view text) {
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] == '#' || (text[i] == '/' && i + 1 < text.size() && text[i + 1] == '/')) {
+            return text.substr(0, i);
+        }
+    }
+    return text;
+}
+
+std::string_view trim(std::string_view text) {
+    size_t first = text.find_first_not_of(" \t\r");
+    if (first == std::string_view::npos) return std::string_view();
+    size_t last = text.find_last_not_of(" \t\r");
+    return text.substr(first, last - first + 1);
+}
+
+std::string toLower(std::string_view view) {
+    std::string text(view);
+    for (char& c : text) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    return text;
+}
+
+// Split operands on commas that are not inside parentheses
+std::vector<std::string> splitOperands(std::string_view text) {
+    std::vector<std::string> operands;
+    int depth = 0;
+    size_t start = 0;
+    operands.reserve(4);
+    for (size_t i = 0; i <= text.size(); i++) {
+        if (i == text.size() || (text[i] == ',' && depth == 0)) {
+            std::string_view operand = trim(text.substr(start, i - start));
+            if (!operand.empty()) operands.emplace_back(operand);
+            start = i + 1;
+        } else if (text[i] == '(') {
+            depth++;
+        } else if (text[i] == ')') {
+            depth--;
+        }
+    }
+    return operands;
+}
+
+bool parseNumber(std::string_view text, int64_t& value) {
+    if (text.empty()) return false;
+    size_t i = 0;
+    bool negative = false;
+    if (text[0] == '-' || text[0] == '+') {
+        negative = text[0] == '-';
+        i = 1;
+    }
+    if (i >= text.size() || !std::isdigit(static_cast<unsigned char>(text[i]))) return false;
+
+    int radix = 10;
+    if (text.size() > i + 1 && text[i] == '0' && (text[i + 1] == 'x' || text[i + 1] == 'X')) {
+        radix = 16;
+        i += 2;
+    } else if (text.size() > i + 1 && text[i] == '0' && (text[i + 1] == 'b' || text[i + 1] == 'B')) {
+        radix = 2;
+        i += 2;
+    }
+    if (i >= text.size()) return false;
+
+    int64_t result = 0;
+    for (; i < text.size(); i++) {
+        int digit;
+        char c = static_cast<char>(std::tolower(static_cast<unsigned char>(text[i])));
+        if (c >= '0' && c <= '9') digit = c - '0';
+        else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+        else return false;
+        if (digit >= radix) return false;
+        result = result * radix + digit;
+    }
+    value = negative ? -result : result;
+    return true;
+}
+
+// Sum "+" / "-" separated terms; lookup resolves the terms that are not numbers
+template <typename Lookup>
+bool sumTerms(std::string_view text, int64_t& value, Lookup lookup) {
+    value = 0;
+    size_t i = 0;
+    while (i < text.size()) {
+        int sign = 1;
+        while (i < text.size() && (text[i] == '+' || text[i] == '-' || text[i] == ' ')) {
+            if (text[i] == '-') sign = -sign;
+            i++;
+        }
+        size_t start = i;
+        while (i < text.size() && text[i] != '+' && text[i] != '-' && text[i] != ' ') i++;
+        std::string_view term = text.substr(start, i - start);
+        if (term.empty()) return false;
+
+        int64_t termValue;
+        if (!parseNumber(term, termValue) && !lookup(std::string(term), termValue)) return false;
+        value += sign * termValue;
+    }
+    return !text.empty();
+}
+
+int64_t signExtend12(int64_t value) {
+    value &= 0xFFF;
+    return value & 0x800 ? value - 0x1000 : value;
+}
+
+bool fitsSigned(int64_t value, int bits) {
+    return value >= -(int64_t(1) << (bits - 1)) && value < (int64_t(1) << (bits - 1));
+}
+
+uint32_t rType(uint32_t opcode, uint32_t rd, uint32_t funct3, uint32_t rs1, uint32_t rs2, uint32_t funct7) {
+    return funct7 << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | opcode;
+}
+
+uint32_t iType(uint32_t opcode, uint32_t rd, uint32_t funct3, uint32_t rs1, int64_t imm) {
+    return (static_cast<uint32_t>(imm) & 0xFFF) << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | opcode;
+}
+
+uint32_t sType(uint32_t opcode, uint32_t funct3, uint32_t rs1, uint32_t rs2, int64_t imm) {
+    uint32_t bits = static_cast<uint32_t>(imm);
+    return ((bits >> 5) & 0x7F) << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 | (bits & 0x1F) << 7 | opcode;
+}
+
+uint32_t bType(uint32_t opcode, uint32_t funct3, uint32_t rs1, uint32_t rs2, int64_t offset) {
+    uint32_t bits = static_cast<uint32_t>(offset);
+    return ((bits >> 12) & 0x1) << 31 | ((bits >> 5) & 0x3F) << 25 | rs2 << 20 | rs1 << 15 |
+           funct3 << 12 | ((bits >> 1) & 0xF) << 8 | ((bits >> 11) & 0x1) << 7 | opcode;
+}
+
+uint32_t uType(uint32_t opcode, uint32_t rd, int64_t imm20) {
+    return (static_cast<uint32_t>(imm20) & 0xFFFFF) << 12 | rd << 7 | opcode;
+}
+
+uint32_t jType(uint32_t opcode, uint32_t rd, int64_t offset) {
+    uint32_t bits = static_cast<uint32_t>(offset);
+    return ((bits >> 20) & 0x1) << 31 | ((bits >> 1) & 0x3FF) << 21 | ((bits >> 11) & 0x1) << 20 |
+           ((bits >> 12) & 0xFF) << 12 | rd << 7 | opcode;
+}
+
+} // namespace
+
+// Constructor: the assembler writes into the caller's memory image
+Assembler::Assembler(uint8_t* memory, uint32_t memorySize)
+    : memory(memory), memorySize(memorySize), sectionSize{0, 0}, sectionAlignment{4, 4}, textBase(0), dataBase(0),
+      errorCount(0) {}
+
+// Read the whole file and assemble it
+bool Assembler::assembleFile(const std::string& path, uint32_t baseAddress) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Failed to open " << path << std::endl;
+        return false;
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    return assemble(buffer.str(), baseAddress, path);
+}
+
+// Assemble source text: pass 1 sizes everything and places labels, pass 2 encodes
+bool Assembler::assemble(const std::string& source, uint32_t baseAddress, const std::string& name) {
+    sourceName = name;
+    statements.clear();
+    labels.clear();
+    constants.clear();
+    symbolTable.clear();
+    pcrelOffsets.clear();
+    sectionSize[SECTION_TEXT] = sectionSize[SECTION_DATA] = 0;
+    sectionAlignment[SECTION_TEXT] = sectionAlignment[SECTION_DATA] = 4;
+    textBase = baseAddress;     // Known up front, so .text pads to absolute addresses
+    errorCount = 0;
+
+    statements.reserve(source.size() / 16);
+
+    Section section = SECTION_TEXT;
+    int line = 0;
+    size_t start = 0;
+    while (start <= source.size()) {
+        size_t end = source.find('\n', start);
+        if (end == std::string::npos) end = source.size();
+        parseLine(std::string_view(source).substr(start, end - start), ++line, section);
+        start = end + 1;
+    }
+    if (errorCount > 0) return false;
+
+    uint32_t dataAlignment = sectionAlignment[SECTION_DATA];
+    dataBase = (textEnd() + dataAlignment - 1) & ~(dataAlignment - 1);
+    if (dataEnd() > memorySize) {
+        std::cerr << sourceName << ": program does not fit in memory (ends at 0x" << std::hex << dataEnd()
+                  << ", memory size 0x" << memorySize << ")" << std::dec << std::endl;
+        return false;
+    }
+
+    symbolTable.reserve(labels.size());
+    for (const auto& label : labels) {
+        uint32_t base = label.second.section == SECTION_TEXT ? textBase : dataBase;
+        symbolTable[label.first] = base + label.second.offset;
+    }
+
+    for (const Statement& statement : statements) {
+        emit(statement);
+    }
+    return errorCount == 0;
+}
+
+// Pass 1 for one source line: ';' separates statements, as in GNU as
+void Assembler::parseLine(std::string_view text, int line, Section& section) {
+    std::string_view body = stripComment(text);
+    size_t separator;
+    while ((separator = body.find(';')) != std::string_view::npos) {
+        parseStatement(body.substr(0, separator), line, section);
+        body = body.substr(separator + 1);
+    }
+    parseStatement(body, line, section);
+}
+
+// Pass 1 for one statement
+void Assembler::parseStatement(std::string_view body, int line, Section& section) {
+    // Leading labels
+    while (true) {
+        body = trim(body);
+        size_t length = 0;
+        while (length < body.size() && isSymbolChar(body[length])) length++;
+        if (length == 0 || length >= body.size() || body[length] != ':') break;
+
+        std::string name(body.substr(0, length));
+        if (labels.count(name) || constants.count(name)) {
+            error(line, "duplicate label '" + name + "'");
+        } else {
+            labels[name] = {section, sectionSize[section]};
+        }
+        body = body.substr(length + 1);
+    }
+    if (body.empty()) return;
+
+    size_t split = body.find_first_of(" \t");
+    std::string mnemonic = toLower(body.substr(0, split));
+    std::vector<std::string> operands = split == std::string::npos ? std::vector<std::string>()
+                                                                   : splitOperands(body.substr(split + 1));
+
+    if (mnemonic[0] != '.') {
+        if (section != SECTION_TEXT) {
+            error(line, "instruction '" + mnemonic + "' outside .text");
+            return;
+        }
+        expandPseudo(line, section, mnemonic, operands);
+        return;
+    }
+
+    if (mnemonic == ".text") {
+        section = SECTION_TEXT;
+    } else if (mnemonic == ".data" || mnemonic == ".rodata" || mnemonic == ".bss") {
+        section = SECTION_DATA;
+    } else if (mnemonic == ".section") {
+        std::string target = operands.empty() ? "" : operands[0];
+        section = target.compare(0, 5, ".text") == 0 ? SECTION_TEXT : SECTION_DATA;
+    } else if (mnemonic == ".equ" || mnemonic == ".set") {
+        int64_t value;
+        if (operands.size() != 2 || !tryConstant(operands[1], value)) {
+            error(line, mnemonic + " expects a name and a constant");
+        } else {
+            constants[operands[0]] = value;
+        }
+    } else if (mnemonic.compare(0, 5, ".cfi_") == 0) {
+        return;
+    } else {
+        for (const char* ignored : ignoredDirectives) {
+            if (mnemonic == ignored) return;
+        }
+        addData(line, section, mnemonic, operands);
+    }
+}
+
+// Record a real instruction after checking its mnemonic and operand count
+void Assembler::addInstruction(int line, Section section, const std::string& mnemonic,
+                               std::vector<std::string> operands, const OpInfo* op) {
+    if (op == nullptr) {
+        auto it = opcodeTable.find(mnemonic);
+        if (it == opcodeTable.end()) {
+            error(line, "unknown instruction '" + mnemonic + "'");
+            return;
+        }
+        op = &it->second;
+    }
+
+    size_t expected = 0;
+    switch (op->format) {
+        case FMT_R: case FMT_I: case FMT_SHIFT: case FMT_BRANCH: case FMT_FP_CMP: expected = 3; break;
+        case FMT_LOAD: case FMT_STORE: case FMT_U: case FMT_JAL: case FMT_LOAD_FP: case FMT_STORE_FP:
+        case FMT_LR: expected = 2; break;
+        case FMT_AMO: expected = 3; break;
+        case FMT_JALR: expected = operands.size() == 3 ? 3 : 2; break;
+        case FMT_FP_R: expected = 3; break;
+        case FMT_FP_R1: case FMT_FP_TO_INT: case FMT_INT_TO_FP: expected = 2; break;
+        case FMT_FP_R4: expected = 4; break;
+        case FMT_FENCE: expected = operands.size() == 2 ? 2 : 0; break;
+        case FMT_SYSTEM: expected = 0; break;
+    }
+    if (op->funct3 == RM_OPERAND && operands.size() == expected + 1) {
+        expected++;
+    }
+    if (operands.size() != expected) {
+        error(line, "'" + mnemonic + "' expects " + std::to_string(expected) + " operands");
+        return;
+    }
+
+    statements.push_back({line, section, sectionSize[section], 4, op, mnemonic, std::move(operands)});
+    sectionSize[section] += 4;
+}
+
+// Expand pseudo-instructions into real ones; everything else goes straight through
+void Assembler::expandPseudo(int line, Section section, const std::string& mnemonic,
+                             std::vector<std::string>& ops) {
+    // Real instructions skip the pseudo table (jal / jalr have one-operand pseudo forms)
+    if (ops.size() > 1) {
+        auto it = opcodeTable.find(mnemonic);
+        if (it != opcodeTable.end()) {
+            addInstruction(line, section, mnemonic, std::move(ops), &it->second);
+            return;
+        }
+    }
+
+    auto arity = [&](size_t count) {
+        if (ops.size() != count) {
+            error(line, "'" + mnemonic + "' expects " + std::to_string(count) + " operands");
+            return false;
+        }
+        return true;
+    };
+
+    if (mnemonic == "nop") {
+        if (arity(0)) addInstruction(line, section, "addi", {"zero", "zero", "0"});
+    } else if (mnemonic == "mv") {
+        if (arity(2)) addInstruction(line, section, "addi", {ops[0], ops[1], "0"});
+    } else if (mnemonic == "not") {
+        if (arity(2)) addInstruction(line, section, "xori", {ops[0], ops[1], "-1"});
+    } else if (mnemonic == "neg") {
+        if (arity(2)) addInstruction(line, section, "sub", {ops[0], "zero", ops[1]});
+    } else if (mnemonic == "seqz") {
+        if (arity(2)) addInstruction(line, section, "sltiu", {ops[0], ops[1], "1"});
+    } else if (mnemonic == "snez") {
+        if (arity(2)) addInstruction(line, section, "sltu", {ops[0], "zero", ops[1]});
+    } else if (mnemonic == "sltz") {
+        if (arity(2)) addInstruction(line, section, "slt", {ops[0], ops[1], "zero"});
+    } else if (mnemonic == "sgtz") {
+        if (arity(2)) addInstruction(line, section, "slt", {ops[0], "zero", ops[1]});
+    } else if (mnemonic == "beqz") {
+        if (arity(2)) addInstruction(line, section, "beq", {ops[0], "zero", ops[1]});
+    } else if (mnemonic == "bnez") {
+        if (arity(2)) addInstruction(line, section, "bne", {ops[0], "zero", ops[1]});
+    } else if (mnemonic == "blez") {
+        if (arity(2)) addInstruction(line, section, "bge", {"zero", ops[0], ops[1]});
+    } else if (mnemonic == "bgez") {
+        if (arity(2)) addInstruction(line, section, "bge", {ops[0], "zero", ops[1]});
+    } else if (mnemonic == "bltz") {
+        if (arity(2)) addInstruction(line, section, "blt", {ops[0], "zero", ops[1]});
+    } else if (mnemonic == "bgtz") {
+        if (arity(2)) addInstruction(line, section, "blt", {"zero", ops[0], ops[1]});
+    } else if (mnemonic == "bgt" || mnemonic == "ble" || mnemonic == "bgtu" || mnemonic == "bleu") {
+        static const std::unordered_map<std::string, std::string> swapped = {
+            {"bgt", "blt"}, {"ble", "bge"}, {"bgtu", "bltu"}, {"bleu", "bgeu"}};
+        if (arity(3)) addInstruction(line, section, swapped.at(mnemonic), {ops[1], ops[0], ops[2]});
+    } else if (mnemonic == "j" || mnemonic == "tail") {
+        if (arity(1)) addInstruction(line, section, "jal", {"zero", ops[0]});
+    } else if (mnemonic == "call" || (mnemonic == "jal" && ops.size() == 1)) {
+        if (arity(1)) addInstruction(line, section, "jal", {"ra", ops[0]});
+    } else if (mnemonic == "jr") {
+        if (arity(1)) addInstruction(line, section, "jalr", {"zero", "0(" + ops[0] + ")"});
+    } else if (mnemonic == "jalr" && ops.size() == 1) {
+        addInstruction(line, section, "jalr", {"ra", "0(" + ops[0] + ")"});
+    } else if (mnemonic == "ret") {
+        if (arity(0)) addInstruction(line, section, "jalr", {"zero", "0(ra)"});
+    } else if (mnemonic == "fmv.s") {
+        if (arity(2)) addInstruction(line, section, "fsgnj.s", {ops[0], ops[1], ops[1]});
+    } else if (mnemonic == "fneg.s") {
+        if (arity(2)) addInstruction(line, section, "fsgnjn.s", {ops[0], ops[1], ops[1]});
+    } else if (mnemonic == "fabs.s") {
+        if (arity(2)) addInstruction(line, section, "fsgnjx.s", {ops[0], ops[1], ops[1]});
+    } else if (mnemonic == "fmv.x.s" || mnemonic == "fmv.s.x") {
+        if (arity(2)) addInstruction(line, section, mnemonic == "fmv.x.s" ? "fmv.x.w" : "fmv.w.x", ops);
+    } else if (mnemonic == "la") {
+        if (arity(2)) {
+            addInstruction(line, section, "auipc", {ops[0], "%pcrel_hi(" + ops[1] + ")"});
+            addInstruction(line, section, "addi", {ops[0], ops[0], "%pcrel_lo(" + ops[1] + ")"});
+        }
+    } else if (mnemonic == "li") {
+        if (!arity(2)) return;
+        int64_t value;
+        if (!tryConstant(ops[1], value)) {
+            // Symbolic value: always the two-instruction form
+            addInstruction(line, section, "lui", {ops[0], "%hi(" + ops[1] + ")"});
+            addInstruction(line, section, "addi", {ops[0], ops[0], "%lo(" + ops[1] + ")"});
+            return;
+        }
+        if (value < INT32_MIN || value > UINT32_MAX) {
+            error(line, "li value out of 32-bit range");
+            return;
+        }
+        int64_t word = static_cast<int32_t>(static_cast<uint32_t>(value));
+        if (fitsSigned(word, 12)) {
+            addInstruction(line, section, "addi", {ops[0], "zero", std::to_string(word)});
+            return;
+        }
+        int64_t low = signExtend12(word);
+        int64_t high = ((word - low) >> 12) & 0xFFFFF;
+        addInstruction(line, section, "lui", {ops[0], std::to_string(high)});
+        if (low != 0) {
+            addInstruction(line, section, "addi", {ops[0], ops[0], std::to_string(low)});
+        }
+    } else {
+        addInstruction(line, section, mnemonic, std::move(ops));
+    }
+}
+
+// Size a data directive; values are evaluated in pass 2 so they may name later labels
+void Assembler::addData(int line, Section section, const std::string& directive,
+                        const std::vector<std::string>& operands) {
+    uint32_t unit = 0;
+    if (directive == ".word" || directive == ".long" || directive == ".float") unit = 4;
+    else if (directive == ".half" || directive == ".short") unit = 2;
+    else if (directive == ".byte") unit = 1;
+
+    uint32_t size = 0;
+    if (unit != 0) {
+        size = unit * static_cast<uint32_t>(operands.size());
+    } else if (directive == ".space" || directive == ".zero" || directive == ".skip") {
+        int64_t count;
+        if (operands.empty() || !tryConstant(operands[0], count) || count < 0) {
+            error(line, directive + " expects a non-negative constant size");
+            return;
+        }
+        size = static_cast<uint32_t>(count);
+    } else if (directive == ".align" || directive == ".p2align" || directive == ".balign") {
+        int64_t amount;
+        if (operands.empty() || !tryConstant(operands[0], amount) || amount < 0 || amount > 16) {
+            error(line, directive + " expects a small constant");
+            return;
+        }
+        uint32_t alignment = directive == ".balign" ? static_cast<uint32_t>(amount) : 1u << amount;
+        if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+            error(line, ".balign expects a power of two");
+            return;
+        }
+        // .data starts at a multiple of its largest alignment, so its offsets align like addresses
+        uint32_t address = (section == SECTION_TEXT ? textBase : 0) + sectionSize[section];
+        size = ((address + alignment - 1) & ~(alignment - 1)) - address;
+        if (alignment > sectionAlignment[section]) {
+            sectionAlignment[section] = alignment;
+        }
+    } else {
+        error(line, "unsupported directive '" + directive + "'");
+        return;
+    }
+
+    statements.push_back({line, section, sectionSize[section], size, nullptr, directive, operands});
+    sectionSize[section] += size;
+}
+
+// Pass 2: write one statement into memory
+void Assembler::emit(const Statement& statement) {
+    uint32_t address = (statement.section == SECTION_TEXT ? textBase : dataBase) + statement.offset;
+
+    if (statement.op != nullptr) {
+        writeBytes(address, encode(statement, address), 4, statement.line);
+        return;
+    }
+
+    const std::string& directive = statement.mnemonic;
+    if (directive == ".space" || directive == ".zero" || directive == ".skip" ||
+        directive == ".align" || directive == ".p2align" || directive == ".balign") {
+        int64_t fill = 0;
+        if ((directive == ".space" || directive == ".zero" || directive == ".skip") && statement.operands.size() > 1) {
+            evaluate(statement.operands[1], address, fill, statement.line);
+        }
+        for (uint32_t i = 0; i < statement.size; i++) {
+            writeBytes(address + i, static_cast<uint64_t>(fill), 1, statement.line);
+        }
+        return;
+    }
+
+    uint32_t unit = statement.size / static_cast<uint32_t>(statement.operands.size());
+    for (const std::string& operand : statement.operands) {
+        int64_t value = 0;
+        if (directive == ".float") {
+            float f = std::strtof(operand.c_str(), nullptr);
+            uint32_t bits;
+            std::memcpy(&bits, &f, sizeof(bits));
+            value = bits;
+        } else {
+            evaluate(operand, address, value, statement.line);
+        }
+        writeBytes(address, static_cast<uint64_t>(value), unit, statement.line);
+        address += unit;
+    }
+}
+
+// Encode a real instruction located at pc
+uint32_t Assembler::encode(const Statement& statement, uint32_t pc) {
+    const OpInfo& op = *statement.op;
+    const std::vector<std::string>& ops = statement.operands;
+    int line = statement.line;
+    int64_t imm = 0;
+    int base = 0;
+
+    switch (op.format) {
+        case FMT_R:
+            return rType(op.opcode, intRegister(ops[0], line), op.funct3, intRegister(ops[1], line),
+                         intRegister(ops[2], line), op.funct7);
+        case FMT_I:
+            evaluate(ops[2], pc, imm, line);
+            if (!fitsSigned(imm, 12)) error(line, "immediate out of range: " + ops[2]);
+            return iType(op.opcode, intRegister(ops[0], line), op.funct3, intRegister(ops[1], line), imm);
+        case FMT_SHIFT:
+            evaluate(ops[2], pc, imm, line);
+            if (imm < 0 || imm > 31) error(line, "shift amount out of range: " + ops[2]);
+            return iType(op.opcode, intRegister(ops[0], line), op.funct3, intRegister(ops[1], line),
+                         (imm & 0x1F) | static_cast<int64_t>(op.funct7) << 5);
+        case FMT_LOAD:
+            memoryOperand(ops[1], pc, imm, base, line);
+            return iType(op.opcode, intRegister(ops[0], line), op.funct3, base, imm);
+        case FMT_LOAD_FP:
+            memoryOperand(ops[1], pc, imm, base, line);
+            return iType(op.opcode, fpRegister(ops[0], line), op.funct3, base, imm);
+        case FMT_STORE:
+            memoryOperand(ops[1], pc, imm, base, line);
+            return sType(op.opcode, op.funct3, base, intRegister(ops[0], line), imm);
+        case FMT_STORE_FP:
+            memoryOperand(ops[1], pc, imm, base, line);
+            return sType(op.opcode, op.funct3, base, fpRegister(ops[0], line), imm);
+        case FMT_BRANCH:
+            evaluate(ops[2], pc, imm, line);
+            imm -= pc;
+            if (!fitsSigned(imm, 13) || (imm & 1)) error(line, "branch target out of range: " + ops[2]);
+            return bType(op.opcode, op.funct3, intRegister(ops[0], line), intRegister(ops[1], line), imm);
+        case FMT_U:
+            evaluate(ops[1], pc, imm, line);
+            if (imm < -0x80000 || imm > 0xFFFFF) error(line, "upper immediate out of range: " + ops[1]);
+            return uType(op.opcode, intRegister(ops[0], line), imm);
+        case FMT_JAL:
+            evaluate(ops[1], pc, imm, line);
+            imm -= pc;
+            if (!fitsSigned(imm, 21) || (imm & 1)) error(line, "jump target out of range: " + ops[1]);
+            return jType(op.opcode, intRegister(ops[0], line), imm);
+        case FMT_JALR:
+            if (ops.size() == 3) {
+                base = intRegister(ops[1], line);
+                evaluate(ops[2], pc, imm, line);
+            } else if (ops[1].find('(') != std::string::npos) {
+                memoryOperand(ops[1], pc, imm, base, line);
+            } else {
+                base = intRegister(ops[1], line);
+            }
+            if (!fitsSigned(imm, 12)) error(line, "immediate out of range");
+            return iType(op.opcode, intRegister(ops[0], line), op.funct3, base, imm);
+        case FMT_FP_R:
+            return rType(op.opcode, fpRegister(ops[0], line),
+                         op.funct3 == RM_OPERAND ? roundingMode(ops, 3, line) : op.funct3,
+                         fpRegister(ops[1], line), fpRegister(ops[2], line), op.funct7);
+        case FMT_FP_R1:
+            return rType(op.opcode, fpRegister(ops[0], line), roundingMode(ops, 2, line), fpRegister(ops[1], line),
+                         op.rs2, op.funct7);
+        case FMT_FP_CMP:
+            return rType(op.opcode, intRegister(ops[0], line), op.funct3, fpRegister(ops[1], line),
+                         fpRegister(ops[2], line), op.funct7);
+        case FMT_FP_TO_INT:
+            return rType(op.opcode, intRegister(ops[0], line),
+                         op.funct3 == RM_OPERAND ? roundingMode(ops, 2, line) : op.funct3,
+                         fpRegister(ops[1], line), op.rs2, op.funct7);
+        case FMT_INT_TO_FP:
+            return rType(op.opcode, fpRegister(ops[0], line),
+                         op.funct3 == RM_OPERAND ? roundingMode(ops, 2, line) : op.funct3,
+                         intRegister(ops[1], line), op.rs2, op.funct7);
+        case FMT_FP_R4:
+            return static_cast<uint32_t>(fpRegister(ops[3], line)) << 27 |
+                   rType(op.opcode, fpRegister(ops[0], line), roundingMode(ops, 4, line), fpRegister(ops[1], line),
+                         fpRegister(ops[2], line), 0);
+        case FMT_FENCE:
+            if (ops.empty()) return 0x0FF0000F;  // fence iorw, iorw
+            return fenceSet(ops[0], line) << 24 | fenceSet(ops[1], line) << 20 | op.opcode;
+        case FMT_SYSTEM:
+            return rType(op.opcode, 0, 0, 0, op.rs2, 0);
+        case FMT_LR:
+            memoryOperand(ops[1], pc, imm, base, line);
+            if (imm != 0) error(line, "atomic address takes no offset: " + ops[1]);
+            return rType(op.opcode, intRegister(ops[0], line), op.funct3, base, 0, op.funct7);
+        case FMT_AMO:
+            memoryOperand(ops[2], pc, imm, base, line);
+            if (imm != 0) error(line, "atomic address takes no offset: " + ops[2]);
+            return rType(op.opcode, intRegister(ops[0], line), op.funct3, base, intRegister(ops[1], line),
+                         op.funct7);
+    }
+    return 0;
+}
+
+void Assembler::writeBytes(uint32_t address, uint64_t value, uint32_t size, int line) {
+    if (static_cast<uint64_t>(address) + size > memorySize) {
+        error(line, "write outside memory");
+        return;
+    }
+    for (uint32_t i = 0; i < size; i++) {
+        memory[address + i] = static_cast<uint8_t>(value >> (8 * i));   // Little endian
+    }
+}
+
+// Evaluate [%modifier(]term {+|- term}[)] where a term is a number, label or .equ constant
+bool Assembler::evaluate(std::string_view expression, uint32_t pc, int64_t& value, int line) {
+    std::string_view text = trim(expression);
+    if (text.size() > 1 && text[0] == '%') {
+        size_t open = text.find('(');
+        if (open == std::string::npos || text.back() != ')') {
+            error(line, "malformed relocation '" + std::string(text) + "'");
+            return false;
+        }
+        std::string_view modifier = text.substr(1, open - 1);
+        int64_t target;
+        if (!evaluate(text.substr(open + 1, text.size() - open - 2), pc, target, line)) return false;
+
+        if (modifier == "hi") {
+            value = ((target + 0x800) >> 12) & 0xFFFFF;
+        } else if (modifier == "lo") {
+            value = signExtend12(target);
+        } else if (modifier == "pcrel_hi") {
+            value = ((target - pc + 0x800) >> 12) & 0xFFFFF;
+            pcrelOffsets[pc] = target - pc;
+        } else if (modifier == "pcrel_lo") {
+            // Either the symbol of the auipc just before (as "la" writes it) or, as in GNU as, the
+            // label of the auipc whose %pcrel_hi it completes
+            auto previous = pcrelOffsets.find(pc - 4);
+            auto labelled = pcrelOffsets.find(static_cast<uint32_t>(target));
+            if ((previous == pcrelOffsets.end() || previous->second != target - (pc - 4)) &&
+                labelled != pcrelOffsets.end()) {
+                value = signExtend12(labelled->second);
+            } else {
+                value = signExtend12(target - (pc - 4));
+            }
+        } else {
+            error(line, "unknown relocation '%" + std::string(modifier) + "'");
+            return false;
+        }
+        return true;
+    }
+
+    bool undefined = false;
+    bool ok = sumTerms(text, value, [&](const std::string& term, int64_t& termValue) {
+        auto label = symbolTable.find(term);
+        if (label != symbolTable.end()) {
+            termValue = label->second;
+            return true;
+        }
+        auto constant = constants.find(term);
+        if (constant != constants.end()) {
+            termValue = constant->second;
+            return true;
+        }
+        error(line, "undefined symbol '" + term + "'");
+        undefined = true;
+        return false;
+    });
+    if (!ok && !undefined) {
+        error(line, "malformed expression '" + std::string(text) + "'");
+    }
+    return ok;
+}
+
+// Evaluate an expression made only of numbers and .equ constants (usable during pass 1)
+bool Assembler::tryConstant(std::string_view expression, int64_t& value) const {
+    return sumTerms(trim(expression), value, [&](const std::string& term, int64_t& termValue) {
+        auto constant = constants.find(term);
+        if (constant == constants.end()) return false;
+        termValue = constant->second;
+        return true;
+    });
+}
+
+int Assembler::intRegister(std::string_view name, int line) {
+    int number = intRegisterNumber(name);
+    if (number >= 0) return number;
+    error(line, "expected an integer register, got '" + std::string(name) + "'");
+    return 0;
+}
+
+int Assembler::fpRegister(std::string_view name, int line) {
+    int number = fpRegisterNumber(name);
+    if (number >= 0) return number;
+    error(line, "expected a floating point register, got '" + std::string(name) + "'");
+    return 0;
+}
+
+// Parse "offset(base)"; the offset may itself contain parentheses, e.g. "%lo(X)(a0)"
+void Assembler::memoryOperand(const std::string& operand, uint32_t pc, int64_t& offset, int& base, int line) {
+    size_t open = operand.rfind('(');
+    if (open == std::string::npos || operand.back() != ')') {
+        error(line, "expected offset(register), got '" + operand + "'");
+        return;
+    }
+    std::string_view view(operand);
+    base = intRegister(std::string(trim(view.substr(open + 1, view.size() - open - 2))), line);
+    std::string offsetText(trim(view.substr(0, open)));
+    offset = 0;
+    if (!offsetText.empty()) evaluate(offsetText, pc, offset, line);
+    if (!fitsSigned(offset, 12)) error(line, "offset out of range: " + offsetText);
+}
+
+// Optional trailing rounding mode operand; dynamic rounding when absent
+uint32_t Assembler::roundingMode(const std::vector<std::string>& operands, size_t index, int line) {
+    if (index >= operands.size()) return 7;
+    auto it = roundingModes.find(toLower(operands[index]));
+    if (it == roundingModes.end()) {
+        error(line, "unknown rounding mode '" + operands[index] + "'");
+        return 7;
+    }
+    return it->second;
+}
+
+// Fence predecessor / successor set such as "rw": i = 8, o = 4, r = 2, w = 1
+uint32_t Assembler::fenceSet(const std::string& operand, int line) {
+    static const char order[] = "iorw";
+    uint32_t set = 0;
+    size_t next = 0;
+    for (char c : toLower(operand)) {
+        size_t position = next;
+        while (position < 4 && order[position] != c) position++;
+        if (position == 4) {
+            error(line, "bad fence set '" + operand + "', expected letters from 'iorw' in that order");
+            return 0xF;
+        }
+        set |= 8u >> position;
+        next = position + 1;
+    }
+    if (set == 0) error(line, "empty fence set");
+    return set;
+}
+
+void Assembler::error(int line, const std::string& message) {
+    std::cerr << sourceName << ":" << line << ": error: " << message << std::endl;
+    errorCount++;
+}
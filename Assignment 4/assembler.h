@@ -0,0 +1,94 @@
+// assembler.h
+#ifndef ASSEMBLER_H
+#define ASSEMBLER_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+
+// Two-pass RV32IF assembler that emits straight into guest memory.
+// The .text section is placed at the base address and .data follows it, aligned to a word or to
+// the largest .align inside it, so alignment within a section is alignment in memory.
+// Comments start with # or //; ';' separates statements on a line.
+class Assembler {
+public:
+    Assembler(uint8_t* memory, uint32_t memorySize);
+
+    // Assemble a source file / source text at baseAddress; errors go to std::cerr
+    bool assembleFile(const std::string& path, uint32_t baseAddress);
+    bool assemble(const std::string& source, uint32_t baseAddress, const std::string& name = "<source>");
+
+    // Address range of the emitted code and data
+    uint32_t textStart() const { return textBase; }
+    uint32_t textEnd() const { return textBase + sectionSize[SECTION_TEXT]; }
+    uint32_t dataStart() const { return dataBase; }
+    uint32_t dataEnd() const { return dataBase + sectionSize[SECTION_DATA]; }
+
+    // Label name -> absolute address, valid after a successful assemble
+    const std::unordered_map<std::string, uint32_t>& symbols() const { return symbolTable; }
+
+    // Encoding of a real instruction (see assembler.cpp)
+    struct OpInfo;
+
+private:
+    enum Section { SECTION_TEXT, SECTION_DATA, NUM_SECTIONS };
+
+    // One instruction or data directive after pseudo-instruction expansion
+    struct Statement {
+        int line;
+        Section section;
+        uint32_t offset;                    // Offset within its section
+        uint32_t size;                      // Bytes emitted
+        const OpInfo* op;                   // Null for data directives
+        std::string mnemonic;
+        std::vector<std::string> operands;
+    };
+
+    struct Label {
+        Section section;
+        uint32_t offset;
+    };
+
+    uint8_t* memory;
+    uint32_t memorySize;
+
+    std::string sourceName;
+    std::vector<Statement> statements;
+    std::unordered_map<std::string, Label> labels;
+    std::unordered_map<std::string, int64_t> constants;     // .equ / .set
+    std::unordered_map<std::string, uint32_t> symbolTable;
+    std::unordered_map<uint32_t, int64_t> pcrelOffsets;    // Pass 2: auipc address -> its %pcrel_hi offset
+    uint32_t sectionSize[NUM_SECTIONS];
+    uint32_t sectionAlignment[NUM_SECTIONS];    // Largest .align seen in each section
+    uint32_t textBase;
+    uint32_t dataBase;
+    int errorCount;
+
+    // Pass 1: labels, directives and pseudo-instruction expansion
+    void parseLine(std::string_view text, int line, Section& section);
+    void parseStatement(std::string_view body, int line, Section& section);
+    void addInstruction(int line, Section section, const std::string& mnemonic, std::vector<std::string> operands,
+                        const OpInfo* op = nullptr);
+    void expandPseudo(int line, Section section, const std::string& mnemonic, std::vector<std::string>& operands);
+    void addData(int line, Section section, const std::string& directive, const std::vector<std::string>& operands);
+
+    // Pass 2: encoding
+    void emit(const Statement& statement);
+    uint32_t encode(const Statement& statement, uint32_t pc);
+    void writeBytes(uint32_t address, uint64_t value, uint32_t size, int line);
+
+    // Operand helpers
+    bool evaluate(std::string_view expression, uint32_t pc, int64_t& value, int line);
+    bool tryConstant(std::string_view expression, int64_t& value) const;
+    int intRegister(std::string_view name, int line);
+    int fpRegister(std::string_view name, int line);
+    void memoryOperand(const std::string& operand, uint32_t pc, int64_t& offset, int& base, int line);
+    uint32_t roundingMode(const std::vector<std::string>& operands, size_t index, int line);
+    uint32_t fenceSet(const std::string& operand, int line);
+
+    void error(int line, const std::string& message);
+};
+
+#endif // ASSEMBLER_H
@@ -0,0 +1,330 @@
+// core.cpp
+#include "core.h"
+
+const char *stall_names[NUM_STALL_REASONS] = {
+    "fetch empty", "dependency", "mem port", "fp busy", "control"
+};
+
+uint32_t float_bits(float f) {
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+float bits_float(uint32_t bits) {
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+uint32_t fclass_bits(float f) {
+    uint32_t bits = float_bits(f);
+    bool negative = bits >> 31;
+    uint32_t exponent = (bits >> 23) & 0xFF;
+    uint32_t fraction = bits & 0x7FFFFF;
+    if (exponent == 0xFF) {
+        if (fraction == 0) return negative ? 1u << 0 : 1u << 7;     // Infinity
+        return fraction & 0x400000 ? 1u << 9 : 1u << 8;             // Quiet / signaling NaN
+    }
+    if (exponent == 0) {
+        if (fraction == 0) return negative ? 1u << 3 : 1u << 4;     // Zero
+        return negative ? 1u << 2 : 1u << 5;                        // Subnormal
+    }
+    return negative ? 1u << 1 : 1u << 6;                            // Normal
+}
+
+// Extract the immediate for the instruction's format
+static int32_t decode_immediate(uint32_t instruction, uint32_t opcode) {
+    switch (opcode) {
+        case OPCODE_LOAD:
+        case OPCODE_LOAD_FP:
+        case OPCODE_OP_IMM:
+        case OPCODE_JALR:
+        case OPCODE_SYSTEM:
+            return (int32_t)instruction >> 20;
+        case OPCODE_STORE:
+        case OPCODE_STORE_FP:
+            return (((int32_t)instruction >> 25) << 5) | ((instruction >> 7) & 0x1F);
+        case OPCODE_BRANCH:
+            return (((int32_t)instruction >> 31) << 12) |
+                   (((instruction >> 7) & 0x1) << 11) |
+                   (((instruction >> 25) & 0x3F) << 5) |
+                   (((instruction >> 8) & 0xF) << 1);
+        case OPCODE_LUI:
+        case OPCODE_AUIPC:
+            return (int32_t)(instruction & 0xFFFFF000);
+        case OPCODE_JAL:
+            return (((int32_t)instruction >> 31) << 20) |
+                   (((instruction >> 12) & 0xFF) << 12) |
+                   (((instruction >> 20) & 0x1) << 11) |
+                   (((instruction >> 21) & 0x3FF) << 1);
+        default:
+            return 0;
+    }
+}
+
+// Decode stage: split the word into fields and work out operand kinds and class
+void decode(uint32_t instruction, uint32_t instr_pc, DecodedInstr *d) {
+    memset(d, 0, sizeof(*d));
+    d->pc = instr_pc;
+    d->instruction = instruction;
+    d->opcode = instruction & 0x7F;
+    d->rd = (instruction >> 7) & 0x1F;
+    d->funct3 = (instruction >> 12) & 0x7;
+    d->rs1 = (instruction >> 15) & 0x1F;
+    d->rs2 = (instruction >> 20) & 0x1F;
+    d->rs3 = (instruction >> 27) & 0x1F;
+    d->funct7 = (instruction >> 25) & 0x7F;
+    d->imm = decode_immediate(instruction, d->opcode);
+    d->iclass = CLASS_ALU;
+
+    switch (d->opcode) {
+        case OPCODE_LUI:
+        case OPCODE_AUIPC:
+        case OPCODE_JAL:
+            d->rd_kind = REG_INT;
+            break;
+        case OPCODE_JALR:
+        case OPCODE_OP_IMM:
+            d->rd_kind = REG_INT;
+            d->rs1_kind = REG_INT;
+            break;
+        case OPCODE_OP:
+            d->rd_kind = REG_INT;
+            d->rs1_kind = d->rs2_kind = REG_INT;
+            break;
+        case OPCODE_BRANCH:
+            d->rs1_kind = d->rs2_kind = REG_INT;
+            break;
+        case OPCODE_LOAD:
+            d->iclass = CLASS_MEM;
+            d->rd_kind = REG_INT;
+            d->rs1_kind = REG_INT;
+            break;
+        case OPCODE_LOAD_FP:
+            d->iclass = CLASS_MEM;
+            d->rd_kind = REG_FP;
+            d->rs1_kind = REG_INT;
+            break;
+        case OPCODE_STORE:
+            d->iclass = CLASS_MEM;
+            d->rs1_kind = d->rs2_kind = REG_INT;
+            break;
+        case OPCODE_STORE_FP:
+            d->iclass = CLASS_MEM;
+            d->rs1_kind = REG_INT;
+            d->rs2_kind = REG_FP;
+            break;
+        case OPCODE_AMO:
+            d->iclass = CLASS_MEM;
+            d->rd_kind = REG_INT;
+            d->rs1_kind = REG_INT;
+            d->rs2_kind = d->rs3 == FUNCT5_LR ? REG_NONE : REG_INT;
+            break;
+        case OPCODE_FMADD:
+        case OPCODE_FMSUB:
+        case OPCODE_FNMSUB:
+        case OPCODE_FNMADD:
+            d->iclass = CLASS_FP;
+            d->rd_kind = REG_FP;
+            d->rs1_kind = d->rs2_kind = d->rs3_kind = REG_FP;
+            break;
+        case OPCODE_OP_FP:
+            d->iclass = CLASS_FP;
+            switch (d->funct7) {
+                case 0x2C:  // fsqrt.s
+                    d->rd_kind = REG_FP;
+                    d->rs1_kind = REG_FP;
+                    break;
+                case 0x50:  // feq.s / flt.s / fle.s
+                    d->rd_kind = REG_INT;
+                    d->rs1_kind = d->rs2_kind = REG_FP;
+                    break;
+                case 0x60:  // fcvt.w.s / fcvt.wu.s
+                case 0x70:  // fmv.x.w / fclass.s
+                    d->rd_kind = REG_INT;
+                    d->rs1_kind = REG_FP;
+                    break;
+                case 0x68:  // fcvt.s.w / fcvt.s.wu
+                case 0x78:  // fmv.w.x
+                    d->rd_kind = REG_FP;
+                    d->rs1_kind = REG_INT;
+                    break;
+                default:    // fadd / fsub / fmul / fdiv / fsgnj / fmin / fmax
+                    d->rd_kind = REG_FP;
+                    d->rs1_kind = d->rs2_kind = REG_FP;
+                    break;
+            }
+            break;
+        default:
+            d->iclass = CLASS_SYSTEM;
+            break;
+    }
+
+    if (d->rd_kind == REG_INT && d->rd == 0) {
+        d->rd_kind = REG_NONE;  // Writes to x0 are discarded
+    }
+}
+
+
+// Mnemonic of a decoded instruction, for reports
+const char *instr_name(const DecodedInstr *d) {
+    static const char *loads[8] = {"lb", "lh", "lw", NULL, "lbu", "lhu", NULL, NULL};
+    static const char *stores[8] = {"sb", "sh", "sw", NULL, NULL, NULL, NULL, NULL};
+    static const char *branches[8] = {"beq", "bne", NULL, NULL, "blt", "bge", "bltu", "bgeu"};
+    static const char *op_imm[8] = {"addi", "slli", "slti", "sltiu", "xori", "srli", "ori", "andi"};
+    static const char *op[8] = {"add", "sll", "slt", "sltu", "xor", "srl", "or", "and"};
+    const char *name = NULL;
+
+    switch (d->opcode) {
+        case OPCODE_LUI: return "lui";
+        case OPCODE_AUIPC: return "auipc";
+        case OPCODE_JAL: return "jal";
+        case OPCODE_JALR: return "jalr";
+        case OPCODE_BRANCH: name = branches[d->funct3]; break;
+        case OPCODE_LOAD: name = loads[d->funct3]; break;
+        case OPCODE_STORE: name = stores[d->funct3]; break;
+        case OPCODE_LOAD_FP: return "flw";
+        case OPCODE_STORE_FP: return "fsw";
+        case OPCODE_OP_IMM:
+            name = d->funct3 == 5 && (d->funct7 & 0x20) ? "srai" : op_imm[d->funct3];
+            break;
+        case OPCODE_OP:
+            if (d->funct7 == 0x20) name = d->funct3 == 0 ? "sub" : d->funct3 == 5 ? "sra" : NULL;
+            else if (d->funct7 == 0) name = op[d->funct3];
+            break;
+        case OPCODE_FMADD: return "fmadd.s";
+        case OPCODE_FMSUB: return "fmsub.s";
+        case OPCODE_FNMSUB: return "fnmsub.s";
+        case OPCODE_FNMADD: return "fnmadd.s";
+        case OPCODE_OP_FP:
+            switch (d->funct7) {
+                case 0x00: return "fadd.s";
+                case 0x04: return "fsub.s";
+                case 0x08: return "fmul.s";
+                case 0x0C: return "fdiv.s";
+                case 0x2C: return "fsqrt.s";
+                case 0x10: return d->funct3 == 0 ? "fsgnj.s" : d->funct3 == 1 ? "fsgnjn.s" : "fsgnjx.s";
+                case 0x14: return d->funct3 == 0 ? "fmin.s" : "fmax.s";
+                case 0x50: return d->funct3 == 2 ? "feq.s" : d->funct3 == 1 ? "flt.s" : "fle.s";
+                case 0x60: return d->rs2 == 0 ? "fcvt.w.s" : "fcvt.wu.s";
+                case 0x68: return d->rs2 == 0 ? "fcvt.s.w" : "fcvt.s.wu";
+                case 0x70: return d->funct3 == 0 ? "fmv.x.w" : "fclass.s";
+                case 0x78: return "fmv.w.x";
+            }
+            break;
+        case OPCODE_MISC_MEM: return "fence";
+        case OPCODE_SYSTEM: return d->imm == 1 ? "ebreak" : "ecall";
+        case OPCODE_AMO:
+            switch (d->rs3) {
+                case FUNCT5_LR: return "lr.w";
+                case FUNCT5_SC: return "sc.w";
+                case 0x00: return "amoadd.w";
+                case 0x01: return "amoswap.w";
+                case 0x04: return "amoxor.w";
+                case 0x08: return "amoor.w";
+                case 0x0C: return "amoand.w";
+                case 0x10: return "amomin.w";
+                case 0x14: return "amomax.w";
+                case 0x18: return "amominu.w";
+                case 0x1C: return "amomaxu.w";
+            }
+            break;
+    }
+    return name != NULL ? name : "unknown";
+}
+
+// RAM operation of an amo*.w funct5
+bool amo_operation(uint32_t funct5, RAM::AtomicOp *op) {
+    switch (funct5) {
+        case 0x00: *op = RAM::AMO_ADD; return true;
+        case 0x01: *op = RAM::AMO_SWAP; return true;
+        case 0x04: *op = RAM::AMO_XOR; return true;
+        case 0x08: *op = RAM::AMO_OR; return true;
+        case 0x0C: *op = RAM::AMO_AND; return true;
+        case 0x10: *op = RAM::AMO_MIN; return true;
+        case 0x14: *op = RAM::AMO_MAX; return true;
+        case 0x18: *op = RAM::AMO_MINU; return true;
+        case 0x1C: *op = RAM::AMO_MAXU; return true;
+        default: return false;
+    }
+}
+
+const char *fusion_names[NUM_FUSION_KINDS] = {
+    "none", "lui+load", "lui+addi", "shift+add", "addi+branch"
+};
+
+FusionKind fusion_kind(const DecodedInstr *first, const DecodedInstr *second) {
+    if (first->rd_kind != REG_INT) {
+        return FUSE_NONE;   // Nothing to forward (or a write to x0)
+    }
+    uint32_t rd = first->rd;
+
+    switch (first->opcode) {
+        case OPCODE_LUI:
+            if ((second->opcode == OPCODE_LOAD && second->funct3 == 2) || second->opcode == OPCODE_LOAD_FP) {
+                return second->rs1 == rd ? FUSE_LUI_LOAD : FUSE_NONE;
+            }
+            if (second->opcode == OPCODE_OP_IMM && second->funct3 == 0) {
+                return second->rs1 == rd ? FUSE_LUI_ADDI : FUSE_NONE;
+            }
+            return FUSE_NONE;
+        case OPCODE_OP_IMM:
+            if (first->funct3 == 1 && second->opcode == OPCODE_OP && second->funct3 == 0 && second->funct7 == 0) {
+                return second->rs1 == rd || second->rs2 == rd ? FUSE_SHIFT_ADD : FUSE_NONE;
+            }
+            if (first->funct3 == 0 && second->opcode == OPCODE_BRANCH) {
+                return second->rs1 == rd || second->rs2 == rd ? FUSE_ADDI_BRANCH : FUSE_NONE;
+            }
+            return FUSE_NONE;
+        default:
+            return FUSE_NONE;
+    }
+}
+
+// Pre-instantiated configurations. Each entry compiles its own copy of the pipeline with the
+// issue width and feature toggles folded in; add a line here to make another one selectable.
+#define CORE_PRESET(W, HOOKS, CACHES, FP, COUNTERS, FUSION) \
+    { W, HOOKS, CACHES, FP, COUNTERS, FUSION, create_core<CoreConfig<W, HOOKS, CACHES, FP, COUNTERS, FUSION>> }
+#define CORE_PRESET_WIDTHS(HOOKS, CACHES, FP, COUNTERS, FUSION) \
+    CORE_PRESET(1, HOOKS, CACHES, FP, COUNTERS, FUSION), CORE_PRESET(2, HOOKS, CACHES, FP, COUNTERS, FUSION), \
+    CORE_PRESET(3, HOOKS, CACHES, FP, COUNTERS, FUSION), CORE_PRESET(4, HOOKS, CACHES, FP, COUNTERS, FUSION)
+
+static const CorePreset core_presets[] = {
+    // Observed runs (the per-cycle trace is an observer), as used in the lab write-ups
+    CORE_PRESET_WIDTHS(true, true, true, true, false),
+    CORE_PRESET_WIDTHS(true, false, true, true, false),
+    // Quiet runs with the full summary
+    CORE_PRESET_WIDTHS(false, true, true, true, false),
+    CORE_PRESET_WIDTHS(false, false, true, true, false),
+    // Quiet runs reporting only cycles and CPI, with and without the FP unit
+    CORE_PRESET_WIDTHS(false, true, true, false, false),
+    CORE_PRESET_WIDTHS(false, false, true, false, false),
+    CORE_PRESET_WIDTHS(false, true, false, false, false),
+    CORE_PRESET_WIDTHS(false, false, false, false, false),
+    // Macro-op fusion, observed and quiet, with the full summary
+    CORE_PRESET_WIDTHS(true, true, true, true, true),
+    CORE_PRESET_WIDTHS(true, false, true, true, true),
+    CORE_PRESET_WIDTHS(false, true, true, true, true),
+    CORE_PRESET_WIDTHS(false, false, true, true, true),
+};
+
+const CorePreset *find_core_preset(int issue_width, bool hooks, bool caches, bool fp_unit, bool counters,
+                                   bool fusion) {
+    for (const CorePreset &preset : core_presets) {
+        if (preset.issue_width == issue_width && preset.hooks == hooks && preset.caches == caches &&
+            preset.fp_unit == fp_unit && preset.counters == counters && preset.fusion == fusion) {
+            return &preset;
+        }
+    }
+    return NULL;
+}
+
+void print_core_presets(FILE *out) {
+    fprintf(out, "Available core configurations (width, hooks, caches, fp, counters, fusion):\n");
+    for (const CorePreset &preset : core_presets) {
+        fprintf(out, "  %d-wide  %-8s %-9s %-6s %-9s %s\n", preset.issue_width,
+                preset.hooks ? "hooks" : "-", preset.caches ? "caches" : "-",
+                preset.fp_unit ? "fp" : "-", preset.counters ? "counters" : "-", preset.fusion ? "fusion" : "-");
+    }
+}
@@ -0,0 +1,1011 @@
+// core.h
+#ifndef CORE_H
+#define CORE_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+
+#include "host_profile.h"
+#include "observer.h"
+#include "ram.h"
+#include "store_buffer.h"
+#include "prefetcher.h"
+#include "profiler.h"
+
+#define NUM_REGISTERS 32
+#define MAX_ISSUE_WIDTH 4       // Widest pre-instantiated configuration
+
+// RISC-V opcodes
+#define OPCODE_LOAD     0x03
+#define OPCODE_LOAD_FP  0x07
+#define OPCODE_MISC_MEM 0x0F
+#define OPCODE_OP_IMM   0x13
+#define OPCODE_AUIPC    0x17
+#define OPCODE_STORE    0x23
+#define OPCODE_STORE_FP 0x27
+#define OPCODE_AMO      0x2F
+#define OPCODE_OP       0x33
+#define OPCODE_LUI      0x37
+#define OPCODE_FMADD    0x43
+#define OPCODE_FMSUB    0x47
+#define OPCODE_FNMSUB   0x4B
+#define OPCODE_FNMADD   0x4F
+#define OPCODE_OP_FP    0x53
+#define OPCODE_BRANCH   0x63
+#define OPCODE_JALR     0x67
+#define OPCODE_JAL      0x6F
+#define OPCODE_SYSTEM   0x73
+
+// RV32A funct5 (instruction bits 31:27) of the reservation pair; the rest are amo*.w
+#define FUNCT5_LR 0x02
+#define FUNCT5_SC 0x03
+
+// Instruction classes used by the issue rules
+typedef enum {
+    CLASS_ALU,      // RV32I arithmetic, branches and jumps
+    CLASS_FP,       // RV32F arithmetic
+    CLASS_MEM,      // Loads, stores (integer and FP) and atomics
+    CLASS_SYSTEM    // ecall / ebreak / fence
+} InstrClass;
+
+// Why an issue slot went unused in a cycle
+typedef enum {
+    STALL_FETCH_EMPTY,  // Fetch queue had nothing to offer
+    STALL_DEPENDENCY,   // Source register not ready yet (RAW)
+    STALL_MEM_PORT,     // Data port already used this cycle or still busy
+    STALL_FP_BUSY,      // FP unit already used this cycle or still busy
+    STALL_CONTROL,      // Behind a taken branch / jump in the same cycle
+    NUM_STALL_REASONS
+} StallReason;
+
+extern const char *stall_names[NUM_STALL_REASONS];
+
+// Register operand kinds
+#define REG_NONE 0
+#define REG_INT  1
+#define REG_FP   2
+
+// Decoded form of a fetched instruction word
+typedef struct {
+    uint32_t pc;
+    uint32_t instruction;
+    uint32_t opcode;
+    uint32_t rd, rs1, rs2, rs3;
+    uint32_t funct3, funct7;
+    int32_t imm;
+    InstrClass iclass;
+    uint8_t rd_kind, rs1_kind, rs2_kind, rs3_kind;
+} DecodedInstr;
+
+// Fetch queue entry
+typedef struct {
+    uint32_t pc;
+    uint32_t instruction;
+} FetchEntry;
+
+uint32_t float_bits(float f);
+float bits_float(uint32_t bits);
+// fclass.s: one of ten bits set for -inf, -normal, -subnormal, -0, +0, +subnormal, +normal,
+// +inf, signaling NaN, quiet NaN
+uint32_t fclass_bits(float f);
+
+// Decode stage: split the word into fields and work out operand kinds and class
+void decode(uint32_t instruction, uint32_t instr_pc, DecodedInstr *d);
+
+// Mnemonic of a decoded instruction, for reports
+const char *instr_name(const DecodedInstr *d);
+
+// RAM operation of an amo*.w funct5; false for lr.w / sc.w and unassigned encodings
+bool amo_operation(uint32_t funct5, RAM::AtomicOp *op);
+
+// Macro-op fusion: adjacent instruction pairs that execute as one operation
+typedef enum {
+    FUSE_NONE,
+    FUSE_LUI_LOAD,      // lui rd, %hi(X) + lw / flw r, %lo(X)(rd)
+    FUSE_LUI_ADDI,      // lui rd, %hi(X) + addi r, rd, %lo(X)
+    FUSE_SHIFT_ADD,     // slli rd, rs, n + add r, rd, rb (indexing)
+    FUSE_ADDI_BRANCH,   // addi rd, ... + b<cond> on rd (loop compare)
+    NUM_FUSION_KINDS
+} FusionKind;
+
+extern const char *fusion_names[NUM_FUSION_KINDS];
+
+// Which idiom first followed by second forms, FUSE_NONE if they do not fuse.
+// The second instruction always consumes the first one's result.
+FusionKind fusion_kind(const DecodedInstr *first, const DecodedInstr *second);
+
+// Compile-time core configuration. Everything the per-cycle loop looks at is a constant here,
+// so each configuration gets its own specialized pipeline and disabled features compile out.
+template <int IssueWidth, bool Hooks, bool Caches, bool FpUnit, bool Counters, bool Fusion>
+struct CoreConfig {
+    // Front end
+    static constexpr int ISSUE_WIDTH = IssueWidth;
+    static constexpr int FETCH_QUEUE_SIZE = 8;      // Instructions buffered between fetch and issue
+    static constexpr int NUM_MEM_PORTS = 1;         // Data port: one memory op per cycle
+    static constexpr int NUM_FP_UNITS = 1;          // One (unpipelined) FP unit
+
+    // Timing in simulation ticks
+    static constexpr int CPU_CYCLE_TICKS = 10;
+    static constexpr int RV32I_LATENCY_TICKS = 10;
+    static constexpr int RV32F_LATENCY_TICKS = 50;
+
+    // Feature toggles
+    static constexpr bool HOOKS = Hooks;            // Report fetch / retire / memory / cycle events to observers
+                                                    // and time the host phases (see HostProfile)
+    static constexpr bool CACHES = Caches;          // Store buffer and prefetcher on the data port
+    static constexpr bool FP_UNIT = FpUnit;         // RV32F; without it FP instructions halt the core
+    static constexpr bool COUNTERS = Counters;      // Per-slot issue / stall and memory statistics, profiling
+    static constexpr bool FUSION = Fusion;          // Issue fusible pairs (see fusion_kind) in one slot
+};
+
+// Everything a core needs that is only known at run time
+struct CoreSetup {
+    RAM *ram;
+    StoreBuffer *store_buffer;      // Unused by configurations without caches
+    PrefetchUnit *prefetch_unit;    // May be NULL
+    Profiler *profiler;             // May be NULL; only configurations with counters feed it
+    uint32_t program_end;           // Fetch stops here; ra points here so returning from main ends the run
+    uint32_t stack_top;
+    std::vector<CoreObserver *> observers;  // Only configurations with hooks report to them
+    uint32_t hart_id = 0;           // Passed in a0, with num_harts in a1, so cores can split work
+    uint32_t num_harts = 1;
+};
+
+// Run-time interface of a core, whatever configuration it was compiled for
+class CoreModel {
+public:
+    virtual ~CoreModel() {}
+
+    // Simulate until the program leaves its code or halts, then finish()
+    virtual void run() = 0;
+    // Simulate up to cycles more cycles; returns how many ran (fewer once the program is done)
+    virtual uint64_t step(uint64_t cycles) = 0;
+    // Run until the end of the cycle in which the instruction at pc issues; false if the program ended first
+    virtual bool run_until_pc(uint32_t pc) = 0;
+    // Run until simulation time reaches tick; false if the program ended first
+    virtual bool run_until_tick(uint64_t tick) = 0;
+    // Run until predicate holds after a cycle; false if the program ended first
+    virtual bool run_until(const std::function<bool(const CoreModel &)> &predicate) = 0;
+    // Drain memory and print the summary (once)
+    virtual void finish() = 0;
+
+    // The program left its code or halted
+    virtual bool done() const = 0;
+    virtual uint64_t cycles() const = 0;
+    // Cycles until the last result landed, as the summary reports them (at least cycles())
+    virtual uint64_t total_cycles() const = 0;
+    virtual uint64_t ticks() const = 0;
+    virtual uint64_t instructions() const = 0;
+    // Address of the next instruction to issue
+    virtual uint32_t next_pc() const = 0;
+
+    // Integer and Floating Point Register Banks
+    uint32_t int_regs[NUM_REGISTERS] = {};
+    float fp_regs[NUM_REGISTERS] = {};
+};
+
+// In-order N-wide pipeline (fetch queue, decode / issue with a scoreboard, execute),
+// specialized for one CoreConfig
+template <class Config>
+class Core final : public CoreModel {
+    static_assert(Config::ISSUE_WIDTH >= 1 && Config::ISSUE_WIDTH <= Config::FETCH_QUEUE_SIZE,
+                  "issue width must fit in the fetch queue");
+
+public:
+    explicit Core(const CoreSetup &setup);
+
+    void run() override;
+    uint64_t step(uint64_t cycles) override;
+    bool run_until_pc(uint32_t target) override;
+    bool run_until_tick(uint64_t tick) override;
+    bool run_until(const std::function<bool(const CoreModel &)> &predicate) override;
+    void finish() override;
+
+    bool done() const override { return halted || (pc >= program_end && fq_count == 0); }
+    uint64_t cycles() const override { return cycle; }
+    uint64_t total_cycles() const override { return last_completion > cycle ? last_completion : cycle; }
+    uint64_t ticks() const override { return cycle * Config::CPU_CYCLE_TICKS; }
+    uint64_t instructions() const override { return instructions_retired; }
+    uint32_t next_pc() const override { return fq_count > 0 ? fetch_queue[fq_head].pc : pc; }
+
+    // Print the per-slot issue statistics and the overall CPI
+    void print_statistics() const;
+
+    // Program Counter (next fetch address)
+    uint32_t pc = 0;
+
+private:
+    // Host phase timers are only compiled into cores with hooks
+    typedef TimedPhaseScope<Config::HOOKS> PhaseScope;
+
+    RAM &ram;
+    StoreBuffer *store_buffer;
+    PrefetchUnit *prefetch_unit;
+    Profiler *profiler;
+    uint32_t program_end;
+    int mem_access_ticks = 0;       // Latency charged to the last data port access
+
+    // Scoreboard: cycle in which each register's pending value becomes available
+    uint64_t int_ready[NUM_REGISTERS] = {};
+    uint64_t fp_ready[NUM_REGISTERS] = {};
+    // PC of the instruction each register is waiting on, for profiling
+    uint32_t int_producer[NUM_REGISTERS] = {};
+    uint32_t fp_producer[NUM_REGISTERS] = {};
+
+    uint64_t cycle = 0;
+
+    // Front end state
+    FetchEntry fetch_queue[Config::FETCH_QUEUE_SIZE];
+    uint32_t fq_head = 0;
+    uint32_t fq_count = 0;
+
+    // Structural hazards
+    uint64_t mem_port_free = 0;     // First cycle the data port is free again
+    uint64_t fp_unit_free = 0;      // First cycle the FP unit is free again
+    uint64_t last_completion = 0;   // Cycle in which the youngest result lands
+
+    // Statistics
+    uint64_t instructions_retired = 0;
+    uint64_t slot_issued[Config::ISSUE_WIDTH] = {};
+    uint64_t slot_stalls[Config::ISSUE_WIDTH][NUM_STALL_REASONS] = {};
+    uint64_t fused_pairs[NUM_FUSION_KINDS] = {};
+    uint64_t atomic_ops = 0;
+    uint64_t sc_failures = 0;
+
+    // What the profiler charges the current cycle to: the instruction in the first issue slot
+    uint32_t profile_pc = 0;
+    int profile_stall = Profiler::NO_STALL;
+    uint32_t profile_blame = Profiler::NO_PC;
+    bool jump_pending = false;      // A call / return to apply once the cycle is charged
+    DecodedInstr jump_instr;
+    uint32_t jump_target = 0;
+
+    bool halted = false;
+    bool finished = false;
+
+    // lr.w reservation: the word and its line's generation at the time
+    bool reservation_valid = false;
+    uint32_t reservation_address = 0;
+    uint32_t reservation_generation = 0;
+
+    // Observers, and the breakpoint run_until_pc is waiting for
+    std::vector<CoreObserver *> observers;
+    uint32_t watch_pc = 0;
+    bool watch_hit = false;
+
+    uint32_t mem_read(uint32_t address, int size, uint32_t instr_pc);
+    void mem_write(uint32_t address, uint32_t value, int size, uint32_t instr_pc);
+    void notify_memory(uint32_t instr_pc, uint32_t address, uint32_t value, int size, MemoryAccess access);
+    void mem_fence(uint32_t instr_pc);
+    uint32_t mem_atomic(const DecodedInstr *d, uint32_t address, uint32_t operand);
+    uint64_t latency_cycles(const DecodedInstr *d) const;
+    bool operand_ready(uint8_t kind, uint32_t reg) const;
+    void execute_fp(const DecodedInstr *d);
+    bool execute(const DecodedInstr *d, uint32_t *next_pc);
+    void fetch();
+    void stall_slots(int first_slot, StallReason reason);
+    uint32_t producer_of(const DecodedInstr *d) const;
+    bool fuses_with(const DecodedInstr *first, DecodedInstr *second, FusionKind *kind) const;
+    template <bool WatchPc> void issue();
+    template <bool WatchPc> uint64_t run_cycles(uint64_t end_cycle);
+};
+
+// A pre-instantiated configuration that can be picked at startup
+struct CorePreset {
+    int issue_width;
+    bool hooks;
+    bool caches;
+    bool fp_unit;
+    bool counters;
+    bool fusion;
+    CoreModel *(*create)(const CoreSetup &setup);
+};
+
+// Look up the preset matching the requested features; NULL when it was not instantiated
+const CorePreset *find_core_preset(int issue_width, bool hooks, bool caches, bool fp_unit, bool counters,
+                                   bool fusion);
+
+// List the pre-instantiated configurations
+void print_core_presets(FILE *out);
+
+// Factory stored in the preset table: a core of this configuration with ra / sp set up
+template <class Config>
+CoreModel *create_core(const CoreSetup &setup) {
+    Core<Config> *core = new Core<Config>(setup);
+    core->int_regs[1] = setup.program_end;  // ra
+    core->int_regs[2] = setup.stack_top;    // sp
+    core->int_regs[10] = setup.hart_id;     // a0
+    core->int_regs[11] = setup.num_harts;   // a1
+    return core;
+}
+
+template <class Config>
+Core<Config>::Core(const CoreSetup &setup)
+    : ram(*setup.ram), store_buffer(setup.store_buffer), prefetch_unit(setup.prefetch_unit),
+      profiler(setup.profiler), program_end(setup.program_end), observers(setup.observers) {}
+
+// Data port accessors: go through the store buffer (or straight to RAM without caches) at the
+// current tick and record the latency they cost in mem_access_ticks; out of range accesses halt
+template <class Config>
+uint32_t Core<Config>::mem_read(uint32_t address, int size, uint32_t instr_pc) {
+    PhaseScope host_phase(PHASE_MEMORY);
+    uint64_t ticks = cycle * Config::CPU_CYCLE_TICKS;
+    uint64_t start = ticks;
+    uint32_t value = 0;
+    try {
+        if constexpr (Config::CACHES) {
+            value = store_buffer->read(address, ticks, size, instr_pc);
+        } else {
+            (void)instr_pc;
+            value = ram.read(address, ticks, size);
+        }
+    } catch (const std::out_of_range &) {
+        printf("Load out of bounds at address 0x%08X\n", address);
+        halted = true;
+    }
+    mem_access_ticks = ticks - start;
+    if constexpr (Config::HOOKS) {
+        notify_memory(instr_pc, address, value, size, ACCESS_READ);
+    }
+    return value;
+}
+
+template <class Config>
+void Core<Config>::mem_write(uint32_t address, uint32_t value, int size, uint32_t instr_pc) {
+    PhaseScope host_phase(PHASE_MEMORY);
+    uint64_t ticks = cycle * Config::CPU_CYCLE_TICKS;
+    uint64_t start = ticks;
+    try {
+        if constexpr (Config::CACHES) {
+            store_buffer->write(address, value, ticks, size);
+        } else {
+            ram.write(address, value, ticks, size);
+        }
+    } catch (const std::out_of_range &) {
+        printf("Store out of bounds at address 0x%08X\n", address);
+        halted = true;
+    }
+    mem_access_ticks = ticks - start;
+    if constexpr (Config::HOOKS) {
+        notify_memory(instr_pc, address, value, size, ACCESS_WRITE);
+    }
+}
+
+template <class Config>
+void Core<Config>::notify_memory(uint32_t instr_pc, uint32_t address, uint32_t value, int size,
+                                 MemoryAccess access) {
+    PhaseScope host_phase(PHASE_LOGGING, !observers.empty());
+    MemoryEvent event = { cycle, cycle * Config::CPU_CYCLE_TICKS, instr_pc, address, value, size, access,
+                          mem_access_ticks };
+    for (CoreObserver *observer : observers) {
+        observer->on_memory(event);
+    }
+}
+
+// Wait for the store buffer to empty (fence and end of run)
+template <class Config>
+void Core<Config>::mem_fence(uint32_t instr_pc) {
+    PhaseScope host_phase(PHASE_MEMORY);
+    if constexpr (Config::CACHES) {
+        uint64_t ticks = cycle * Config::CPU_CYCLE_TICKS;
+        uint64_t start = ticks;
+        store_buffer->drain(ticks);
+        mem_access_ticks = ticks - start;
+    }
+    if constexpr (Config::HOOKS) {
+        notify_memory(instr_pc, 0, 0, 0, ACCESS_FENCE);
+    }
+}
+
+// Atomic on shared RAM. The core's own buffered stores are drained first, which also covers
+// every aq / rl ordering, and the access then bypasses the store buffer and prefetcher so
+// cores on other threads see it at once. Its latency is the drain plus the RAM accesses.
+// sc.w succeeds only if no store from any core reached the word's line since lr.w took the
+// reservation, so an intervening store of the same value still fails it.
+template <class Config>
+uint32_t Core<Config>::mem_atomic(const DecodedInstr *d, uint32_t address, uint32_t operand) {
+    PhaseScope host_phase(PHASE_MEMORY);
+    uint64_t ticks = cycle * Config::CPU_CYCLE_TICKS;
+    uint64_t start = ticks;
+    if constexpr (Config::CACHES) {
+        store_buffer->drain(ticks);
+    }
+    uint32_t funct5 = d->instruction >> 27;
+    uint32_t result = 0;
+    try {
+        RAM::AtomicOp op;
+        if (funct5 == FUNCT5_LR) {
+            result = ram.loadReserved(address, reservation_generation, ticks);
+            reservation_valid = true;
+            reservation_address = address;
+        } else if (funct5 == FUNCT5_SC) {
+            bool stored = reservation_valid && reservation_address == address &&
+                          ram.storeConditional(address, operand, reservation_generation, ticks);
+            reservation_valid = false;
+            result = stored ? 0 : 1;
+            if constexpr (Config::COUNTERS) {
+                if (!stored) sc_failures++;
+            }
+        } else if (amo_operation(funct5, &op)) {
+            result = ram.atomicRmw(address, op, operand, ticks);
+        } else {
+            printf("Unknown atomic instruction: 0x%08X\n", d->instruction);
+            halted = true;
+        }
+    } catch (const std::out_of_range &) {
+        printf("Atomic access misaligned or out of bounds at address 0x%08X\n", address);
+        halted = true;
+    }
+    mem_access_ticks = ticks - start;
+    if constexpr (Config::COUNTERS) {
+        atomic_ops++;
+    }
+    if constexpr (Config::HOOKS) {
+        notify_memory(d->pc, address, funct5 == FUNCT5_LR ? result : operand, 4, ACCESS_ATOMIC);
+    }
+    return result;
+}
+
+// Latency of an instruction in CPU cycles, from issue until its result is usable
+template <class Config>
+uint64_t Core<Config>::latency_cycles(const DecodedInstr *d) const {
+    switch (d->iclass) {
+        case CLASS_FP:
+            return Config::RV32F_LATENCY_TICKS / Config::CPU_CYCLE_TICKS;
+        case CLASS_MEM:
+            return (Config::RV32I_LATENCY_TICKS + mem_access_ticks + Config::CPU_CYCLE_TICKS - 1) /
+                   Config::CPU_CYCLE_TICKS;
+        default:
+            return Config::RV32I_LATENCY_TICKS / Config::CPU_CYCLE_TICKS;
+    }
+}
+
+template <class Config>
+bool Core<Config>::operand_ready(uint8_t kind, uint32_t reg) const {
+    if (kind == REG_INT) return reg == 0 || int_ready[reg] <= cycle;
+    if (kind == REG_FP) return fp_ready[reg] <= cycle;
+    return true;
+}
+
+template <class Config>
+void Core<Config>::execute_fp(const DecodedInstr *d) {
+    float a = fp_regs[d->rs1];
+    float b = fp_regs[d->rs2];
+    int32_t ia = (int32_t)int_regs[d->rs1];
+
+    switch (d->funct7) {
+        case 0x00: fp_regs[d->rd] = a + b; break;
+        case 0x04: fp_regs[d->rd] = a - b; break;
+        case 0x08: fp_regs[d->rd] = a * b; break;
+        case 0x0C: fp_regs[d->rd] = a / b; break;
+        case 0x2C: fp_regs[d->rd] = sqrtf(a); break;
+        case 0x10: {
+            uint32_t sign_a = float_bits(a) & 0x7FFFFFFF;
+            uint32_t sign_b = float_bits(b) & 0x80000000;
+            if (d->funct3 == 1) sign_b ^= 0x80000000;                          // fsgnjn.s
+            if (d->funct3 == 2) sign_b ^= float_bits(a) & 0x80000000;          // fsgnjx.s
+            fp_regs[d->rd] = bits_float(sign_a | sign_b);
+            break;
+        }
+        case 0x14: fp_regs[d->rd] = d->funct3 == 0 ? fminf(a, b) : fmaxf(a, b); break;
+        case 0x50:
+            if (d->rd != 0) {
+                if (d->funct3 == 2) int_regs[d->rd] = a == b;
+                else if (d->funct3 == 1) int_regs[d->rd] = a < b;
+                else int_regs[d->rd] = a <= b;
+            }
+            break;
+        case 0x60:
+            if (d->rd != 0) {
+                int_regs[d->rd] = d->rs2 == 0 ? (uint32_t)(int32_t)a : (uint32_t)a;
+            }
+            break;
+        case 0x68:
+            fp_regs[d->rd] = d->rs2 == 0 ? (float)ia : (float)int_regs[d->rs1];
+            break;
+        case 0x70:
+            if (d->rd != 0) int_regs[d->rd] = d->funct3 == 1 ? fclass_bits(a) : float_bits(a);
+            break;
+        case 0x78:
+            fp_regs[d->rd] = bits_float(int_regs[d->rs1]);
+            break;
+        default:
+            printf("Unknown or unimplemented FP instruction: 0x%08X\n", d->instruction);
+            break;
+    }
+}
+
+// Execute stage: Perform the operation; returns true and sets *next_pc on a taken branch or jump
+template <class Config>
+bool Core<Config>::execute(const DecodedInstr *d, uint32_t *next_pc) {
+    PhaseScope host_phase(PHASE_EXECUTE);
+    if constexpr (!Config::FP_UNIT) {
+        if (d->iclass == CLASS_FP || d->opcode == OPCODE_LOAD_FP || d->opcode == OPCODE_STORE_FP) {
+            printf("FP instruction 0x%08X at PC 0x%08X on a core without an FP unit, halting.\n",
+                   d->instruction, d->pc);
+            halted = true;
+            return false;
+        }
+    }
+
+    uint32_t a = int_regs[d->rs1];
+    uint32_t b = int_regs[d->rs2];
+    uint32_t result = 0;
+    bool writes_int = d->rd_kind == REG_INT;
+
+    switch (d->opcode) {
+        case OPCODE_LUI:
+            result = d->imm;
+            break;
+        case OPCODE_AUIPC:
+            result = d->pc + d->imm;
+            break;
+        case OPCODE_JAL:
+            result = d->pc + 4;
+            *next_pc = d->pc + d->imm;
+            break;
+        case OPCODE_JALR:
+            result = d->pc + 4;
+            *next_pc = (a + d->imm) & ~1u;
+            break;
+        case OPCODE_BRANCH: {
+            bool taken = false;
+            switch (d->funct3) {
+                case 0: taken = a == b; break;                      // beq
+                case 1: taken = a != b; break;                      // bne
+                case 4: taken = (int32_t)a < (int32_t)b; break;     // blt
+                case 5: taken = (int32_t)a >= (int32_t)b; break;    // bge
+                case 6: taken = a < b; break;                       // bltu
+                case 7: taken = a >= b; break;                      // bgeu
+            }
+            if (taken) *next_pc = d->pc + d->imm;
+            break;
+        }
+        case OPCODE_LOAD: {
+            uint32_t addr = a + d->imm;
+            switch (d->funct3) {
+                case 0: result = (int32_t)(int8_t)mem_read(addr, 1, d->pc); break;     // lb
+                case 1: result = (int32_t)(int16_t)mem_read(addr, 2, d->pc); break;    // lh
+                case 2: result = mem_read(addr, 4, d->pc); break;                      // lw
+                case 4: result = mem_read(addr, 1, d->pc); break;                      // lbu
+                case 5: result = mem_read(addr, 2, d->pc); break;                      // lhu
+            }
+            break;
+        }
+        case OPCODE_LOAD_FP:
+            fp_regs[d->rd] = bits_float(mem_read(a + d->imm, 4, d->pc));
+            break;
+        case OPCODE_STORE: {
+            int size = 1 << (d->funct3 & 0x3);
+            mem_write(a + d->imm, b, size, d->pc);
+            break;
+        }
+        case OPCODE_STORE_FP:
+            mem_write(a + d->imm, float_bits(fp_regs[d->rs2]), 4, d->pc);
+            break;
+        case OPCODE_OP_IMM: {
+            uint32_t shamt = d->imm & 0x1F;
+            switch (d->funct3) {
+                case 0: result = a + d->imm; break;                                         // addi
+                case 1: result = a << shamt; break;                                         // slli
+                case 2: result = (int32_t)a < d->imm; break;                                // slti
+                case 3: result = a < (uint32_t)d->imm; break;                               // sltiu
+                case 4: result = a ^ d->imm; break;                                         // xori
+                case 5: result = d->funct7 & 0x20 ? (uint32_t)((int32_t)a >> shamt)
+                                                  : a >> shamt; break;                      // srai / srli
+                case 6: result = a | d->imm; break;                                         // ori
+                case 7: result = a & d->imm; break;                                         // andi
+            }
+            break;
+        }
+        case OPCODE_OP:
+            switch (d->funct3) {
+                case 0: result = d->funct7 & 0x20 ? a - b : a + b; break;                   // sub / add
+                case 1: result = a << (b & 0x1F); break;                                    // sll
+                case 2: result = (int32_t)a < (int32_t)b; break;                            // slt
+                case 3: result = a < b; break;                                              // sltu
+                case 4: result = a ^ b; break;                                              // xor
+                case 5: result = d->funct7 & 0x20 ? (uint32_t)((int32_t)a >> (b & 0x1F))
+                                                  : a >> (b & 0x1F); break;                 // sra / srl
+                case 6: result = a | b; break;                                              // or
+                case 7: result = a & b; break;                                              // and
+            }
+            break;
+        case OPCODE_FMADD:
+        case OPCODE_FMSUB:
+        case OPCODE_FNMSUB:
+        case OPCODE_FNMADD: {
+            float product = fp_regs[d->rs1] * fp_regs[d->rs2];
+            float addend = fp_regs[d->rs3];
+            if (d->opcode == OPCODE_FMADD) fp_regs[d->rd] = product + addend;
+            if (d->opcode == OPCODE_FMSUB) fp_regs[d->rd] = product - addend;
+            if (d->opcode == OPCODE_FNMSUB) fp_regs[d->rd] = -product + addend;
+            if (d->opcode == OPCODE_FNMADD) fp_regs[d->rd] = -product - addend;
+            break;
+        }
+        case OPCODE_OP_FP:
+            execute_fp(d);
+            writes_int = false;
+            break;
+        case OPCODE_MISC_MEM:
+            mem_fence(d->pc);
+            break;
+        case OPCODE_AMO:
+            result = mem_atomic(d, a, b);
+            break;
+        case OPCODE_SYSTEM:
+            printf("ecall/ebreak at PC 0x%08X, halting.\n", d->pc);
+            halted = true;
+            break;
+        default:
+            printf("Unknown or unimplemented instruction opcode: 0x%02X\n", d->opcode);
+            halted = true;
+            break;
+    }
+
+    if (writes_int) {
+        int_regs[d->rd] = result;
+    }
+    return d->opcode == OPCODE_JAL || d->opcode == OPCODE_JALR ||
+           (d->opcode == OPCODE_BRANCH && *next_pc != d->pc + 4);
+}
+
+// Fetch stage: fill the fetch queue with up to ISSUE_WIDTH sequential words
+template <class Config>
+inline void Core<Config>::fetch() {
+    PhaseScope host_phase(PHASE_FETCH);
+    for (int i = 0; i < Config::ISSUE_WIDTH && fq_count < Config::FETCH_QUEUE_SIZE; i++) {
+        if (pc >= program_end || pc + 4 > RAM::RAM_SIZE) {
+            return;
+        }
+        FetchEntry *entry = &fetch_queue[(fq_head + fq_count) % Config::FETCH_QUEUE_SIZE];
+        entry->instruction = ram.load(pc);
+        entry->pc = pc;
+        fq_count++;
+        if constexpr (Config::HOOKS) {
+            PhaseScope logging(PHASE_LOGGING, !observers.empty());
+            StageEvent event = { cycle, STAGE_FETCH, pc, entry->instruction };
+            for (CoreObserver *observer : observers) {
+                observer->on_stage(event);
+            }
+        }
+        pc += 4;
+    }
+}
+
+// Stop issuing in this cycle and charge the remaining slots to the given reason
+template <class Config>
+void Core<Config>::stall_slots(int first_slot, StallReason reason) {
+    if constexpr (Config::COUNTERS) {
+        for (int slot = first_slot; slot < Config::ISSUE_WIDTH; slot++) {
+            slot_stalls[slot][reason]++;
+        }
+        if (first_slot == 0) {
+            profile_pc = fq_count > 0 ? fetch_queue[fq_head].pc : pc;
+            profile_stall = reason;
+            profile_blame = Profiler::NO_PC;
+        }
+    }
+}
+
+// PC of the instruction producing the first source operand that is not ready yet
+template <class Config>
+uint32_t Core<Config>::producer_of(const DecodedInstr *d) const {
+    const uint8_t kinds[3] = {d->rs1_kind, d->rs2_kind, d->rs3_kind};
+    const uint32_t regs[3] = {d->rs1, d->rs2, d->rs3};
+    for (int i = 0; i < 3; i++) {
+        if (!operand_ready(kinds[i], regs[i])) {
+            return kinds[i] == REG_INT ? int_producer[regs[i]] : fp_producer[regs[i]];
+        }
+    }
+    return Profiler::NO_PC;
+}
+
+// Fusion: decode the entry behind the head of the fetch queue and check that it forms an idiom
+// with first and that everything it reads besides first's result is ready
+template <class Config>
+bool Core<Config>::fuses_with(const DecodedInstr *first, DecodedInstr *second, FusionKind *kind) const {
+    if (fq_count < 2) {
+        return false;
+    }
+    const FetchEntry *entry = &fetch_queue[(fq_head + 1) % Config::FETCH_QUEUE_SIZE];
+    {
+        PhaseScope host_phase(PHASE_DECODE);
+        decode(entry->instruction, entry->pc, second);
+    }
+    *kind = fusion_kind(first, second);
+    if (*kind == FUSE_NONE) {
+        return false;
+    }
+    const uint8_t kinds[3] = {second->rs1_kind, second->rs2_kind, second->rs3_kind};
+    const uint32_t regs[3] = {second->rs1, second->rs2, second->rs3};
+    for (int i = 0; i < 3; i++) {
+        bool forwarded = kinds[i] == REG_INT && regs[i] == first->rd;
+        if (!forwarded && !operand_ready(kinds[i], regs[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Issue stage: decode the head of the fetch queue and issue in order, up to ISSUE_WIDTH
+// instructions per cycle, with at most one memory op and one FP op per cycle. With fusion a
+// fusible pair takes a single slot; the structural checks then apply to its second half.
+template <class Config>
+template <bool WatchPc>
+void Core<Config>::issue() {
+    PhaseScope host_phase(PHASE_ISSUE);
+    int mem_ops = 0;
+    int fp_ops = 0;
+
+    for (int slot = 0; slot < Config::ISSUE_WIDTH; slot++) {
+        if (fq_count == 0) {
+            stall_slots(slot, STALL_FETCH_EMPTY);
+            return;
+        }
+
+        DecodedInstr d;
+        FetchEntry *entry = &fetch_queue[fq_head];
+        {
+            PhaseScope host_phase(PHASE_DECODE);
+            decode(entry->instruction, entry->pc, &d);
+        }
+
+        if (!operand_ready(d.rs1_kind, d.rs1) || !operand_ready(d.rs2_kind, d.rs2) ||
+            !operand_ready(d.rs3_kind, d.rs3)) {
+            stall_slots(slot, STALL_DEPENDENCY);
+            if constexpr (Config::COUNTERS) {
+                if (slot == 0) profile_blame = producer_of(&d);
+            }
+            return;
+        }
+
+        DecodedInstr parts[2];
+        int num_parts = 1;
+        FusionKind fusion = FUSE_NONE;
+        parts[0] = d;
+        if constexpr (Config::FUSION) {
+            if (fuses_with(&d, &parts[1], &fusion)) {
+                num_parts = 2;
+            }
+        }
+        const DecodedInstr *last = &parts[num_parts - 1];
+
+        if (last->iclass == CLASS_MEM && (mem_ops == Config::NUM_MEM_PORTS || mem_port_free > cycle)) {
+            stall_slots(slot, STALL_MEM_PORT);
+            return;
+        }
+        if constexpr (Config::FP_UNIT) {
+            if (last->iclass == CLASS_FP && (fp_ops == Config::NUM_FP_UNITS || fp_unit_free > cycle)) {
+                stall_slots(slot, STALL_FP_BUSY);
+                return;
+            }
+        }
+
+        fq_head = (fq_head + num_parts) % Config::FETCH_QUEUE_SIZE;
+        fq_count -= num_parts;
+        if constexpr (Config::FUSION && Config::COUNTERS) {
+            if (num_parts == 2) fused_pairs[fusion]++;
+        }
+
+        uint32_t next_pc = d.pc + 4;
+        bool redirect = false;
+        for (int part = 0; part < num_parts; part++) {
+            const DecodedInstr *p = &parts[part];
+            next_pc = p->pc + 4;
+            mem_access_ticks = 0;
+            redirect = execute(p, &next_pc);
+
+            // Writeback: the result is in the register file already; mark when it is ready and retire
+            PhaseScope writeback(PHASE_WRITEBACK);
+            uint64_t done = cycle + latency_cycles(p);
+            if (p->rd_kind == REG_INT) int_ready[p->rd] = done;
+            if (p->rd_kind == REG_FP) fp_ready[p->rd] = done;
+            if constexpr (Config::COUNTERS) {
+                if (p->rd_kind == REG_INT) int_producer[p->rd] = p->pc;
+                if (p->rd_kind == REG_FP) fp_producer[p->rd] = p->pc;
+            }
+            if (p->iclass == CLASS_MEM || p->opcode == OPCODE_MISC_MEM) {
+                // Loads hold the port for the RAM access; buffered stores only for the issue cycle
+                uint64_t port_cycles = (mem_access_ticks + Config::CPU_CYCLE_TICKS - 1) / Config::CPU_CYCLE_TICKS;
+                mem_ops++;
+                mem_port_free = cycle + (port_cycles > 0 ? port_cycles : 1);
+            }
+            if (Config::FP_UNIT && p->iclass == CLASS_FP) {
+                fp_ops++;
+                fp_unit_free = done;
+            }
+            if (done > last_completion) last_completion = done;
+
+            if constexpr (Config::COUNTERS) {
+                if (part == 0) {
+                    slot_issued[slot]++;
+                }
+                if (slot == 0 && part == 0) {
+                    profile_pc = p->pc;
+                    profile_stall = Profiler::NO_STALL;
+                    profile_blame = Profiler::NO_PC;
+                }
+                if (profiler != NULL) {
+                    PhaseScope profiling(PHASE_PROFILER);
+                    profiler->retire(p->pc);
+                    if (redirect && (p->opcode == OPCODE_JAL || p->opcode == OPCODE_JALR)) {
+                        jump_instr = *p;
+                        jump_target = next_pc;
+                        jump_pending = true;
+                    }
+                }
+            }
+            instructions_retired++;
+            if constexpr (WatchPc) {
+                if (p->pc == watch_pc) watch_hit = true;
+            }
+            if constexpr (Config::HOOKS) {
+                PhaseScope logging(PHASE_LOGGING, !observers.empty());
+                RetireEvent event = { cycle, slot, p->pc, p->instruction, part > 0 };
+                for (CoreObserver *observer : observers) {
+                    observer->on_retire(event);
+                }
+            }
+
+            if (halted) {
+                return;
+            }
+        }
+        if (redirect) {
+            // Taken branch or jump: squash the sequential fetches and steer the front end
+            if constexpr (Config::HOOKS) {
+                PhaseScope logging(PHASE_LOGGING, !observers.empty());
+                for (uint32_t i = 0; i < fq_count; i++) {
+                    const FetchEntry *squashed = &fetch_queue[(fq_head + i) % Config::FETCH_QUEUE_SIZE];
+                    StageEvent event = { cycle, STAGE_SQUASH, squashed->pc, squashed->instruction };
+                    for (CoreObserver *observer : observers) {
+                        observer->on_stage(event);
+                    }
+                }
+            }
+            pc = next_pc;
+            fq_head = 0;
+            fq_count = 0;
+            stall_slots(slot + 1, STALL_CONTROL);
+            return;
+        }
+    }
+}
+
+template <class Config>
+void Core<Config>::print_statistics() const {
+    uint64_t total = total_cycles();
+    printf("\n==== Simulation summary (%d-wide issue) ====\n", Config::ISSUE_WIDTH);
+    printf("Cycles: %llu  Ticks: %llu  Instructions: %llu\n",
+           (unsigned long long)total, (unsigned long long)(total * Config::CPU_CYCLE_TICKS),
+           (unsigned long long)instructions_retired);
+    if (instructions_retired > 0) {
+        printf("CPI: %.3f  IPC: %.3f\n", (double)total / instructions_retired,
+               (double)instructions_retired / total);
+    }
+
+    if constexpr (Config::COUNTERS) {
+        for (int slot = 0; slot < Config::ISSUE_WIDTH; slot++) {
+            printf("Slot %d: issued %llu", slot, (unsigned long long)slot_issued[slot]);
+            for (int reason = 0; reason < NUM_STALL_REASONS; reason++) {
+                printf(", %s %llu", stall_names[reason], (unsigned long long)slot_stalls[slot][reason]);
+            }
+            printf("\n");
+        }
+        if constexpr (Config::FUSION) {
+            printf("Fused pairs:");
+            for (int kind = FUSE_NONE + 1; kind < NUM_FUSION_KINDS; kind++) {
+                printf(" %s %llu%s", fusion_names[kind], (unsigned long long)fused_pairs[kind],
+                       kind + 1 < NUM_FUSION_KINDS ? "," : "\n");
+            }
+        }
+        if (atomic_ops > 0) {
+            printf("Atomics: %llu, sc.w failures %llu\n", (unsigned long long)atomic_ops,
+                   (unsigned long long)sc_failures);
+        }
+        if constexpr (Config::CACHES) {
+            store_buffer->printStatistics();
+            if (prefetch_unit != NULL) {
+                prefetch_unit->printStatistics();
+            }
+        }
+    }
+}
+
+// Simulate until the program is done or cycle reaches end_cycle; with WatchPc also until the
+// instruction at watch_pc has issued
+template <class Config>
+template <bool WatchPc>
+uint64_t Core<Config>::run_cycles(uint64_t end_cycle) {
+    uint64_t start = cycle;
+    while (!done() && cycle < end_cycle) {
+        cycle++;
+        issue<WatchPc>();
+        if constexpr (Config::COUNTERS) {
+            if (profiler != NULL) {
+                PhaseScope profiling(PHASE_PROFILER);
+                // The cycle a call or return issues in still belongs to the caller / callee
+                profiler->cycle(profile_pc, profile_stall, profile_blame);
+                if (jump_pending) {
+                    profiler->jump(jump_instr.pc, jump_target, jump_instr.rd, jump_instr.rs1,
+                                   jump_instr.opcode == OPCODE_JALR);
+                    jump_pending = false;
+                }
+            }
+        }
+        fetch();
+
+        if constexpr (Config::HOOKS) {
+            PhaseScope logging(PHASE_LOGGING, !observers.empty());
+            for (CoreObserver *observer : observers) {
+                observer->on_cycle(cycle, cycle * Config::CPU_CYCLE_TICKS);
+            }
+        }
+        if constexpr (WatchPc) {
+            if (watch_hit) break;
+        }
+    }
+    return cycle - start;
+}
+
+template <class Config>
+uint64_t Core<Config>::step(uint64_t cycles) {
+    return run_cycles<false>(cycles > UINT64_MAX - cycle ? UINT64_MAX : cycle + cycles);
+}
+
+template <class Config>
+bool Core<Config>::run_until_pc(uint32_t target) {
+    watch_pc = target;
+    watch_hit = false;
+    run_cycles<true>(UINT64_MAX);
+    return watch_hit;
+}
+
+template <class Config>
+bool Core<Config>::run_until_tick(uint64_t tick) {
+    uint64_t end_cycle = (tick + Config::CPU_CYCLE_TICKS - 1) / Config::CPU_CYCLE_TICKS;
+    run_cycles<false>(end_cycle);
+    return cycle >= end_cycle;
+}
+
+template <class Config>
+bool Core<Config>::run_until(const std::function<bool(const CoreModel &)> &predicate) {
+    while (!done()) {
+        run_cycles<false>(cycle + 1);
+        if (predicate(*this)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Buffered stores still have to reach RAM before the run is over
+template <class Config>
+void Core<Config>::finish() {
+    if (finished) {
+        return;
+    }
+    finished = true;
+    if constexpr (Config::CACHES) {
+        uint64_t ticks = cycle * Config::CPU_CYCLE_TICKS;
+        store_buffer->drain(ticks);
+        uint64_t drained = (ticks + Config::CPU_CYCLE_TICKS - 1) / Config::CPU_CYCLE_TICKS;
+        if (drained > last_completion) last_completion = drained;
+    }
+    print_statistics();
+}
+
+// Simulate the CPU pipeline
+template <class Config>
+void Core<Config>::run() {
+    run_cycles<false>(UINT64_MAX);
+    finish();
+}
+
+#endif // CORE_H
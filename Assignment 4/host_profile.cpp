@@ -0,0 +1,236 @@
+// host_profile.cpp
+#include "host_profile.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HOST_TIMER_TSC
+#endif
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+const char *host_phase_names[NUM_HOST_PHASES] = {
+    "fetch", "decode", "issue", "execute", "memory", "writeback", "logging", "profiler"
+};
+
+bool HostProfile::enabled = false;
+
+namespace {
+
+const int MAX_DEPTH = 8;    // Time in deeper phases is charged to the innermost recorded one
+
+// One thread's totals; blocks are never freed so the report can read them after the thread ends
+struct ThreadBlock {
+    uint64_t ticks[NUM_HOST_PHASES] = {};
+    uint64_t calls[NUM_HOST_PHASES] = {};
+    uint64_t last = 0;              // Timestamp the innermost open phase was last charged up to
+    int stack[MAX_DEPTH] = {};
+    int depth = 0;
+    ThreadBlock *next = nullptr;
+};
+
+std::atomic<ThreadBlock *> blocks(nullptr);
+thread_local ThreadBlock *localBlock = nullptr;
+
+uint64_t startTimestamp = 0;
+uint64_t startNanoseconds = 0;
+
+struct HardwareCounter {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+    int fd;
+};
+
+HardwareCounter hardwareCounters[] = {
+#ifdef __linux__
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, -1},
+    {"cache misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, -1},
+#else
+    {"cycles", 0, 0, -1},
+    {"instructions", 0, 0, -1},
+    {"cache misses", 0, 0, -1},
+#endif
+};
+const int NUM_HARDWARE_COUNTERS = sizeof(hardwareCounters) / sizeof(hardwareCounters[0]);
+bool countersRequested = false;
+const char *timedBuild = nullptr;
+const char *countersError = nullptr;
+
+uint64_t nanoseconds() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+inline uint64_t timestamp() {
+#ifdef HOST_TIMER_TSC
+    return __rdtsc();
+#else
+    return nanoseconds();
+#endif
+}
+
+ThreadBlock &threadBlock() {
+    if (localBlock == nullptr) {
+        localBlock = new ThreadBlock();
+        localBlock->next = blocks.load();
+        while (!blocks.compare_exchange_weak(localBlock->next, localBlock)) {
+        }
+    }
+    return *localBlock;
+}
+
+// Count for this process and the threads it starts from now on, user space only
+void openHardwareCounters() {
+#ifdef __linux__
+    for (HardwareCounter &counter : hardwareCounters) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = counter.type;
+        attr.config = counter.config;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        counter.fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        if (counter.fd < 0 && countersError == nullptr) {
+            countersError = strerror(errno);
+        }
+    }
+#else
+    countersError = "perf_event_open needs Linux";
+#endif
+}
+
+bool readHardwareCounter(const HardwareCounter &counter, uint64_t &value) {
+#ifdef __linux__
+    return counter.fd >= 0 && read(counter.fd, &value, sizeof(value)) == (ssize_t)sizeof(value);
+#else
+    (void)counter;
+    (void)value;
+    return false;
+#endif
+}
+
+}  // namespace
+
+void HostProfile::start(bool hardwareCounters, const char *build) {
+    if (enabled) {
+        return;
+    }
+    enabled = true;
+    countersRequested = hardwareCounters;
+    timedBuild = build;
+    if (hardwareCounters) {
+        openHardwareCounters();
+    }
+    startNanoseconds = nanoseconds();
+    startTimestamp = timestamp();
+    atexit([] { printReport(stdout); });
+}
+
+void HostProfile::enter(HostPhase phase) {
+    uint64_t now = timestamp();
+    ThreadBlock &block = threadBlock();
+    if (block.depth > 0) {
+        block.ticks[block.stack[std::min(block.depth, MAX_DEPTH) - 1]] += now - block.last;
+    }
+    if (block.depth < MAX_DEPTH) {
+        block.stack[block.depth] = phase;
+    }
+    block.depth++;
+    block.last = now;
+}
+
+void HostProfile::leave() {
+    uint64_t now = timestamp();
+    ThreadBlock &block = threadBlock();
+    if (block.depth > 0) {
+        int phase = block.stack[std::min(block.depth, MAX_DEPTH) - 1];
+        block.ticks[phase] += now - block.last;
+        if (block.depth <= MAX_DEPTH) {
+            block.calls[phase]++;
+        }
+    }
+    block.depth--;
+    block.last = now;
+}
+
+void HostProfile::printReport(FILE *out) {
+    if (!enabled) {
+        return;
+    }
+    double wallNs = (double)(nanoseconds() - startNanoseconds);
+    uint64_t elapsedTicks = timestamp() - startTimestamp;
+    double nsPerTick = elapsedTicks > 0 ? wallNs / elapsedTicks : 1.0;
+
+    uint64_t ticks[NUM_HOST_PHASES] = {};
+    uint64_t calls[NUM_HOST_PHASES] = {};
+    uint64_t totalTicks = 0;
+    int threads = 0;
+    for (const ThreadBlock *block = blocks.load(); block != nullptr; block = block->next) {
+        for (int phase = 0; phase < NUM_HOST_PHASES; phase++) {
+            ticks[phase] += block->ticks[phase];
+            calls[phase] += block->calls[phase];
+            totalTicks += block->ticks[phase];
+        }
+        threads++;
+    }
+
+#ifdef HOST_TIMER_TSC
+    fprintf(out, "\n==== Host profile (timestamp counter, %.2f GHz) ====\n", 1.0 / nsPerTick);
+#else
+    fprintf(out, "\n==== Host profile (clock_gettime) ====\n");
+#endif
+    if (timedBuild != nullptr) {
+        fprintf(out, "Timed build: %s\n", timedBuild);
+    }
+    fprintf(out, "Wall time %.2f ms, %.2f ms inside phases over %d thread%s\n", wallNs / 1e6,
+            totalTicks * nsPerTick / 1e6, threads, threads == 1 ? "" : "s");
+    fprintf(out, "%-10s %12s %10s %6s %9s\n", "phase", "calls", "ms", "%", "ns/call");
+    for (int phase = 0; phase < NUM_HOST_PHASES; phase++) {
+        if (calls[phase] == 0) {
+            continue;
+        }
+        double ns = ticks[phase] * nsPerTick;
+        fprintf(out, "%-10s %12llu %10.2f %6.1f %9.1f\n", host_phase_names[phase], (unsigned long long)calls[phase],
+                ns / 1e6, totalTicks > 0 ? 100.0 * ticks[phase] / totalTicks : 0.0, ns / calls[phase]);
+    }
+
+    if (!countersRequested) {
+        return;
+    }
+    uint64_t values[NUM_HARDWARE_COUNTERS] = {};
+    bool valid[NUM_HARDWARE_COUNTERS] = {};
+    bool any = false;
+    for (int i = 0; i < NUM_HARDWARE_COUNTERS; i++) {
+        valid[i] = readHardwareCounter(hardwareCounters[i], values[i]);
+        any = any || valid[i];
+    }
+    if (!any) {
+        fprintf(out, "Host counters unavailable: %s\n", countersError != nullptr ? countersError : "read failed");
+        return;
+    }
+    fprintf(out, "Host counters:");
+    for (int i = 0; i < NUM_HARDWARE_COUNTERS; i++) {
+        if (valid[i]) {
+            fprintf(out, " %s %llu", hardwareCounters[i].name, (unsigned long long)values[i]);
+        }
+    }
+    if (valid[0] && valid[1] && values[0] > 0) {
+        fprintf(out, " (IPC %.2f)", (double)values[1] / values[0]);
+    }
+    fprintf(out, "\n");
+}
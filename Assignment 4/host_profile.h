@@ -0,0 +1,81 @@
+// host_profile.h
+#ifndef HOST_PROFILE_H
+#define HOST_PROFILE_H
+
+#include <cstdint>
+#include <cstdio>
+
+// Parts of a simulator the host time is charged to
+typedef enum {
+    PHASE_FETCH,
+    PHASE_DECODE,
+    PHASE_ISSUE,        // Hazard and structural checks around execute
+    PHASE_EXECUTE,
+    PHASE_MEMORY,       // Data accesses through the store buffer / prefetcher / RAM
+    PHASE_WRITEBACK,    // Scoreboard ready times and retirement after execute
+    PHASE_LOGGING,      // Observers: traces and reports
+    PHASE_PROFILER,     // Guest profiler
+    NUM_HOST_PHASES
+} HostPhase;
+
+extern const char *host_phase_names[NUM_HOST_PHASES];
+
+// Self-profile of the simulator itself. Phase scopes read the timestamp counter (clock_gettime
+// where there is none) and charge the time to the innermost open phase, so nested phases are
+// not counted twice. Each thread adds into its own block, without locks; the report sums them.
+// Optionally counts host cycles, instructions and cache misses with perf_event_open.
+class HostProfile {
+public:
+    // Runtime switch, read by every scope; only flip it before the simulation threads start
+    static bool enabled;
+
+    // Enable the timers (and the hardware counters when asked and the kernel allows it) and
+    // print the report when the program exits; build, when given, says in the report header which
+    // build of the simulator was timed
+    static void start(bool hardwareCounters, const char *build = nullptr);
+
+    // Open / close a phase on this thread; use HostPhaseScope rather than calling these
+#if defined(__GNUC__)
+    __attribute__((cold, noinline)) static void enter(HostPhase phase);
+    __attribute__((cold, noinline)) static void leave();
+#else
+    static void enter(HostPhase phase);
+    static void leave();
+#endif
+
+    // Print time per phase and the hardware counters
+    static void printReport(FILE *out);
+};
+
+// Charges the host time until the end of the scope to phase, unless timed is false; costs one
+// predictable branch when profiling is off
+class HostPhaseScope {
+public:
+    explicit HostPhaseScope(HostPhase phase, bool timed = true) : active(HostProfile::enabled && timed) {
+        if (active) HostProfile::enter(phase);
+    }
+    ~HostPhaseScope() {
+        if (active) HostProfile::leave();
+    }
+    HostPhaseScope(const HostPhaseScope &) = delete;
+    HostPhaseScope &operator=(const HostPhaseScope &) = delete;
+
+private:
+    bool active;
+};
+
+// HostPhaseScope for templated code: only compiled in when Timed, otherwise an empty scope that
+// costs nothing at all
+template <bool Timed>
+class TimedPhaseScope : public HostPhaseScope {
+public:
+    explicit TimedPhaseScope(HostPhase phase, bool timed = true) : HostPhaseScope(phase, timed) {}
+};
+
+template <>
+class TimedPhaseScope<false> {
+public:
+    explicit TimedPhaseScope(HostPhase, bool = true) {}
+};
+
+#endif // HOST_PROFILE_H
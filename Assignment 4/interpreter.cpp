@@ -0,0 +1,413 @@
+// interpreter.cpp
+#include "interpreter.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+
+// Handler kinds: one per operation with everything that selects behaviour folded in, so the
+// dispatch loop never looks at funct3 / funct7 again
+enum OpKind : uint8_t {
+    OP_LUI, OP_AUIPC, OP_JAL, OP_JALR,
+    OP_BEQ, OP_BNE, OP_BLT, OP_BGE, OP_BLTU, OP_BGEU, OP_NOP,
+    OP_LB, OP_LH, OP_LW, OP_LBU, OP_LHU, OP_FLW,
+    OP_SB, OP_SH, OP_SW, OP_FSW,
+    OP_ADDI, OP_SLLI, OP_SLTI, OP_SLTIU, OP_XORI, OP_SRLI, OP_SRAI, OP_ORI, OP_ANDI,
+    OP_ADD, OP_SUB, OP_SLL, OP_SLT, OP_SLTU, OP_XOR, OP_SRL, OP_SRA, OP_OR, OP_AND,
+    OP_FADD, OP_FSUB, OP_FMUL, OP_FDIV, OP_FP,
+    OP_FMADD, OP_FMSUB, OP_FNMSUB, OP_FNMADD,
+    OP_AMO, OP_SYSTEM, OP_UNKNOWN,
+    // Fused pairs
+    OP_LUI_LW, OP_LUI_FLW, OP_LUI_ADDI, OP_SLLI_ADD,
+    OP_ADDI_BEQ, OP_ADDI_BNE, OP_ADDI_BLT, OP_ADDI_BGE, OP_ADDI_BLTU, OP_ADDI_BGEU
+};
+
+Interpreter::Interpreter(RAM& ram, uint32_t codeStart, uint32_t codeEnd)
+    : ram(ram), codeStart(codeStart), codeEnd(codeEnd), ops((codeEnd - codeStart) / 4) {
+    for (uint32_t word = 0; word < ops.size(); word++) {
+        predecode(word);
+    }
+    for (uint32_t word = 0; word < ops.size(); word++) {
+        fusedSites[fuse(word)]++;
+    }
+}
+
+// Decode one code word into its single-instruction handler
+void Interpreter::predecode(uint32_t word) {
+    uint32_t pc = codeStart + 4 * word;
+    uint32_t instruction = ram.load(pc);
+    DecodedInstr d;
+    decode(instruction, pc, &d);
+
+    Op& op = ops[word];
+    std::memset(&op, 0, sizeof(op));
+    op.length = 1;
+    op.rd = d.rd;
+    op.rs1 = d.rs1;
+    op.rs2 = d.rs2;
+    op.rs3 = d.rs3;
+    op.funct3 = d.funct3;
+    op.funct7 = d.funct7;
+    op.imm = d.imm;
+
+    static const uint8_t branches[8] = {OP_BEQ, OP_BNE, OP_NOP, OP_NOP, OP_BLT, OP_BGE, OP_BLTU, OP_BGEU};
+    static const uint8_t loads[8] = {OP_LB, OP_LH, OP_LW, OP_UNKNOWN, OP_LBU, OP_LHU, OP_UNKNOWN, OP_UNKNOWN};
+    static const uint8_t stores[8] = {OP_SB, OP_SH, OP_SW, OP_UNKNOWN, OP_UNKNOWN, OP_UNKNOWN, OP_UNKNOWN, OP_UNKNOWN};
+    static const uint8_t opImm[8] = {OP_ADDI, OP_SLLI, OP_SLTI, OP_SLTIU, OP_XORI, OP_SRLI, OP_ORI, OP_ANDI};
+    static const uint8_t opReg[8] = {OP_ADD, OP_SLL, OP_SLT, OP_SLTU, OP_XOR, OP_SRL, OP_OR, OP_AND};
+
+    switch (d.opcode) {
+        case OPCODE_LUI: op.kind = OP_LUI; break;
+        case OPCODE_AUIPC: op.kind = OP_AUIPC; op.imm += pc; break;
+        case OPCODE_JAL: op.kind = OP_JAL; break;
+        case OPCODE_JALR: op.kind = OP_JALR; break;
+        case OPCODE_BRANCH: op.kind = branches[d.funct3]; break;
+        case OPCODE_LOAD:
+            op.kind = loads[d.funct3];
+            if (op.kind == OP_UNKNOWN) {
+                op.kind = OP_LUI;   // Like the core: an unsupported width loads nothing and writes 0
+                op.imm = 0;
+            }
+            break;
+        case OPCODE_LOAD_FP: op.kind = OP_FLW; break;
+        case OPCODE_STORE: op.kind = stores[d.funct3]; break;
+        case OPCODE_STORE_FP: op.kind = OP_FSW; break;
+        case OPCODE_OP_IMM:
+            op.kind = d.funct3 == 5 && (d.funct7 & 0x20) ? (uint8_t)OP_SRAI : opImm[d.funct3];
+            if (op.kind == OP_SLLI || op.kind == OP_SRLI || op.kind == OP_SRAI) op.imm &= 0x1F;
+            break;
+        case OPCODE_OP:
+            if (d.funct3 == 0 && (d.funct7 & 0x20)) op.kind = OP_SUB;
+            else if (d.funct3 == 5 && (d.funct7 & 0x20)) op.kind = OP_SRA;
+            else op.kind = opReg[d.funct3];
+            break;
+        case OPCODE_FMADD: op.kind = OP_FMADD; break;
+        case OPCODE_FMSUB: op.kind = OP_FMSUB; break;
+        case OPCODE_FNMSUB: op.kind = OP_FNMSUB; break;
+        case OPCODE_FNMADD: op.kind = OP_FNMADD; break;
+        case OPCODE_OP_FP:
+            switch (d.funct7) {
+                case 0x00: op.kind = OP_FADD; break;
+                case 0x04: op.kind = OP_FSUB; break;
+                case 0x08: op.kind = OP_FMUL; break;
+                case 0x0C: op.kind = OP_FDIV; break;
+                default: op.kind = OP_FP; break;
+            }
+            break;
+        case OPCODE_MISC_MEM: op.kind = OP_NOP; break;  // Nothing is buffered here
+        case OPCODE_AMO: op.kind = OP_AMO; break;
+        case OPCODE_SYSTEM: op.kind = OP_SYSTEM; break;
+        default: op.kind = OP_UNKNOWN; break;
+    }
+    if (op.kind == OP_UNKNOWN) {
+        op.imm = d.opcode;      // For the error message
+    }
+}
+
+// Replace the handler at word with a fused one when it starts a recognised idiom; the handler
+// of the second word stays as it is so jumps into the middle of the pair still work
+FusionKind Interpreter::fuse(uint32_t word) {
+    if (word + 1 >= ops.size()) {
+        return FUSE_NONE;
+    }
+    uint32_t pc = codeStart + 4 * word;
+    uint32_t instructions[2] = { ram.load(pc), ram.load(pc + 4) };
+    DecodedInstr first, second;
+    decode(instructions[0], pc, &first);
+    decode(instructions[1], pc + 4, &second);
+
+    FusionKind kind = fusion_kind(&first, &second);
+    if (kind == FUSE_NONE) {
+        return FUSE_NONE;
+    }
+    Op& op = ops[word];
+    const Op& next = ops[word + 1];
+    switch (kind) {
+        case FUSE_LUI_LOAD: op.kind = second.opcode == OPCODE_LOAD_FP ? OP_LUI_FLW : OP_LUI_LW; break;
+        case FUSE_LUI_ADDI: op.kind = OP_LUI_ADDI; break;
+        case FUSE_SHIFT_ADD: op.kind = OP_SLLI_ADD; break;
+        case FUSE_ADDI_BRANCH:
+            if (next.kind == OP_NOP) return FUSE_NONE;  // Never-taken encodings are not worth a handler
+            op.kind = OP_ADDI_BEQ + (next.kind - OP_BEQ);
+            break;
+        default:
+            return FUSE_NONE;
+    }
+    op.length = 2;
+    op.rd2 = next.rd;
+    op.rs1b = next.rs1;
+    op.rs2b = next.rs2;
+    op.imm2 = next.imm;
+    return kind;
+}
+
+// Self-modifying code: re-decode every word a store touched, and the word in front of each
+// since it may have fused with it
+void Interpreter::invalidate(uint32_t address, uint32_t size) {
+    uint32_t first = address < codeStart + 4 ? 0 : (address - codeStart) / 4 - 1;
+    uint32_t last = (address + size - 1 - codeStart) / 4;
+    if (last >= ops.size()) last = ops.size() - 1;
+    for (uint32_t word = first; word <= last; word++) {
+        predecode(word);
+    }
+    for (uint32_t word = first; word <= last; word++) {
+        fuse(word);
+    }
+}
+
+// Data accesses go straight to the backing store; out of range accesses halt like on the core
+uint32_t Interpreter::load(uint32_t address, uint32_t size) {
+    if (address + size > RAM::RAM_SIZE || address + size < address) {
+        printf("Load out of bounds at address 0x%08X\n", address);
+        halted = true;
+        return 0;
+    }
+    return ram.load(address, size);
+}
+
+void Interpreter::store(uint32_t address, uint32_t value, uint32_t size) {
+    if (address + size > RAM::RAM_SIZE || address + size < address) {
+        printf("Store out of bounds at address 0x%08X\n", address);
+        halted = true;
+        return;
+    }
+    ram.store(address, value, size);
+    if (address < codeEnd && address + size > codeStart) {
+        invalidate(address, size);
+    }
+}
+
+// lr.w / sc.w / amo*.w (funct5 in rs3) on the shared RAM, so interpreters on other threads see
+// them; sc.w checks no store reached the reserved line since lr.w, as on the core
+uint32_t Interpreter::atomic(const Op& op, uint32_t address, uint32_t operand) {
+    uint64_t ticks = 0;     // No timing here
+    RAM::AtomicOp rmw;
+    try {
+        if (op.rs3 == FUNCT5_LR) {
+            reservationValid = true;
+            reservationAddress = address;
+            return ram.loadReserved(address, reservationGeneration, ticks);
+        }
+        if (op.rs3 == FUNCT5_SC) {
+            bool stored = reservationValid && reservationAddress == address &&
+                          ram.storeConditional(address, operand, reservationGeneration, ticks);
+            reservationValid = false;
+            if (stored && address < codeEnd && address + 4 > codeStart) {
+                invalidate(address, 4);
+            }
+            return stored ? 0 : 1;
+        }
+        if (!amo_operation(op.rs3, &rmw)) {
+            printf("Unknown atomic instruction with funct5 0x%02X\n", op.rs3);
+            halted = true;
+            return 0;
+        }
+        uint32_t old = ram.atomicRmw(address, rmw, operand, ticks);
+        if (address < codeEnd && address + 4 > codeStart) {
+            invalidate(address, 4);
+        }
+        return old;
+    } catch (const std::out_of_range&) {
+        printf("Atomic access misaligned or out of bounds at address 0x%08X\n", address);
+        halted = true;
+        return 0;
+    }
+}
+
+// The less common RV32F operations, with the same semantics as the core's FP unit
+void Interpreter::executeFp(const Op& op) {
+    float a = fpRegs[op.rs1];
+    float b = fpRegs[op.rs2];
+    switch (op.funct7) {
+        case 0x2C: fpRegs[op.rd] = sqrtf(a); break;
+        case 0x10: {
+            uint32_t signA = float_bits(a) & 0x7FFFFFFF;
+            uint32_t signB = float_bits(b) & 0x80000000;
+            if (op.funct3 == 1) signB ^= 0x80000000;                   // fsgnjn.s
+            if (op.funct3 == 2) signB ^= float_bits(a) & 0x80000000;   // fsgnjx.s
+            fpRegs[op.rd] = bits_float(signA | signB);
+            break;
+        }
+        case 0x14: fpRegs[op.rd] = op.funct3 == 0 ? fminf(a, b) : fmaxf(a, b); break;
+        case 0x50:
+            if (op.funct3 == 2) intRegs[op.rd] = a == b;
+            else if (op.funct3 == 1) intRegs[op.rd] = a < b;
+            else intRegs[op.rd] = a <= b;
+            break;
+        case 0x60: intRegs[op.rd] = op.rs2 == 0 ? (uint32_t)(int32_t)a : (uint32_t)a; break;
+        case 0x68:
+            fpRegs[op.rd] = op.rs2 == 0 ? (float)(int32_t)intRegs[op.rs1] : (float)intRegs[op.rs1];
+            break;
+        case 0x70: intRegs[op.rd] = op.funct3 == 1 ? fclass_bits(a) : float_bits(a); break;
+        case 0x78: fpRegs[op.rd] = bits_float(intRegs[op.rs1]); break;
+        default: {
+            uint32_t instruction = ((uint32_t)op.funct7 << 25) | ((uint32_t)op.rs2 << 20) | ((uint32_t)op.rs1 << 15) |
+                                   ((uint32_t)op.funct3 << 12) | ((uint32_t)op.rd << 7) | OPCODE_OP_FP;
+            printf("Unknown or unimplemented FP instruction: 0x%08X\n", instruction);
+            break;
+        }
+    }
+}
+
+uint64_t Interpreter::run(uint32_t entry) {
+    clock_t start = clock();
+    uint32_t* x = intRegs;
+    float* f = fpRegs;
+    uint64_t executed = 0;
+    uint64_t dispatched = 0;
+    uint32_t pc = entry;
+
+    while (!halted && pc >= codeStart && pc < codeEnd) {
+        if (pc & 3) {
+            printf("Misaligned PC 0x%08X, halting.\n", pc);
+            break;
+        }
+        const Op op = ops[(pc - codeStart) >> 2];
+        uint32_t next = pc + 4 * op.length;
+        dispatched++;
+        executed += op.length;
+
+        switch (op.kind) {
+            case OP_LUI: x[op.rd] = op.imm; break;
+            case OP_AUIPC: x[op.rd] = op.imm; break;
+            case OP_JAL: x[op.rd] = pc + 4; next = pc + op.imm; break;
+            case OP_JALR: {
+                uint32_t target = (x[op.rs1] + op.imm) & ~1u;
+                x[op.rd] = pc + 4;
+                next = target;
+                break;
+            }
+            case OP_BEQ: if (x[op.rs1] == x[op.rs2]) next = pc + op.imm; break;
+            case OP_BNE: if (x[op.rs1] != x[op.rs2]) next = pc + op.imm; break;
+            case OP_BLT: if ((int32_t)x[op.rs1] < (int32_t)x[op.rs2]) next = pc + op.imm; break;
+            case OP_BGE: if ((int32_t)x[op.rs1] >= (int32_t)x[op.rs2]) next = pc + op.imm; break;
+            case OP_BLTU: if (x[op.rs1] < x[op.rs2]) next = pc + op.imm; break;
+            case OP_BGEU: if (x[op.rs1] >= x[op.rs2]) next = pc + op.imm; break;
+            case OP_NOP: break;
+
+            case OP_LB: x[op.rd] = (int32_t)(int8_t)load(x[op.rs1] + op.imm, 1); break;
+            case OP_LH: x[op.rd] = (int32_t)(int16_t)load(x[op.rs1] + op.imm, 2); break;
+            case OP_LW: x[op.rd] = load(x[op.rs1] + op.imm, 4); break;
+            case OP_LBU: x[op.rd] = load(x[op.rs1] + op.imm, 1); break;
+            case OP_LHU: x[op.rd] = load(x[op.rs1] + op.imm, 2); break;
+            case OP_FLW: f[op.rd] = bits_float(load(x[op.rs1] + op.imm, 4)); break;
+            case OP_SB: store(x[op.rs1] + op.imm, x[op.rs2], 1); break;
+            case OP_SH: store(x[op.rs1] + op.imm, x[op.rs2], 2); break;
+            case OP_SW: store(x[op.rs1] + op.imm, x[op.rs2], 4); break;
+            case OP_FSW: store(x[op.rs1] + op.imm, float_bits(f[op.rs2]), 4); break;
+
+            case OP_ADDI: x[op.rd] = x[op.rs1] + op.imm; break;
+            case OP_SLLI: x[op.rd] = x[op.rs1] << op.imm; break;
+            case OP_SLTI: x[op.rd] = (int32_t)x[op.rs1] < op.imm; break;
+            case OP_SLTIU: x[op.rd] = x[op.rs1] < (uint32_t)op.imm; break;
+            case OP_XORI: x[op.rd] = x[op.rs1] ^ op.imm; break;
+            case OP_SRLI: x[op.rd] = x[op.rs1] >> op.imm; break;
+            case OP_SRAI: x[op.rd] = (uint32_t)((int32_t)x[op.rs1] >> op.imm); break;
+            case OP_ORI: x[op.rd] = x[op.rs1] | op.imm; break;
+            case OP_ANDI: x[op.rd] = x[op.rs1] & op.imm; break;
+            case OP_ADD: x[op.rd] = x[op.rs1] + x[op.rs2]; break;
+            case OP_SUB: x[op.rd] = x[op.rs1] - x[op.rs2]; break;
+            case OP_SLL: x[op.rd] = x[op.rs1] << (x[op.rs2] & 0x1F); break;
+            case OP_SLT: x[op.rd] = (int32_t)x[op.rs1] < (int32_t)x[op.rs2]; break;
+            case OP_SLTU: x[op.rd] = x[op.rs1] < x[op.rs2]; break;
+            case OP_XOR: x[op.rd] = x[op.rs1] ^ x[op.rs2]; break;
+            case OP_SRL: x[op.rd] = x[op.rs1] >> (x[op.rs2] & 0x1F); break;
+            case OP_SRA: x[op.rd] = (uint32_t)((int32_t)x[op.rs1] >> (x[op.rs2] & 0x1F)); break;
+            case OP_OR: x[op.rd] = x[op.rs1] | x[op.rs2]; break;
+            case OP_AND: x[op.rd] = x[op.rs1] & x[op.rs2]; break;
+
+            case OP_FADD: f[op.rd] = f[op.rs1] + f[op.rs2]; break;
+            case OP_FSUB: f[op.rd] = f[op.rs1] - f[op.rs2]; break;
+            case OP_FMUL: f[op.rd] = f[op.rs1] * f[op.rs2]; break;
+            case OP_FDIV: f[op.rd] = f[op.rs1] / f[op.rs2]; break;
+            case OP_FP: executeFp(op); break;
+            case OP_FMADD: f[op.rd] = f[op.rs1] * f[op.rs2] + f[op.rs3]; break;
+            case OP_FMSUB: f[op.rd] = f[op.rs1] * f[op.rs2] - f[op.rs3]; break;
+            case OP_FNMSUB: f[op.rd] = -(f[op.rs1] * f[op.rs2]) + f[op.rs3]; break;
+            case OP_FNMADD: f[op.rd] = -(f[op.rs1] * f[op.rs2]) - f[op.rs3]; break;
+
+            case OP_AMO: x[op.rd] = atomic(op, x[op.rs1], x[op.rs2]); break;
+            case OP_SYSTEM:
+                printf("ecall/ebreak at PC 0x%08X, halting.\n", pc);
+                halted = true;
+                break;
+            case OP_UNKNOWN:
+                printf("Unknown or unimplemented instruction opcode: 0x%02X\n", (unsigned)op.imm);
+                halted = true;
+                break;
+
+            // Fused pairs: the first result is in a register the second one reads (never x0)
+            case OP_LUI_LW:
+                x[op.rd] = op.imm;
+                x[op.rd2] = load(op.imm + op.imm2, 4);
+                fused[FUSE_LUI_LOAD]++;
+                break;
+            case OP_LUI_FLW:
+                x[op.rd] = op.imm;
+                f[op.rd2] = bits_float(load(op.imm + op.imm2, 4));
+                fused[FUSE_LUI_LOAD]++;
+                break;
+            case OP_LUI_ADDI:
+                x[op.rd] = op.imm;
+                x[op.rd2] = op.imm + op.imm2;
+                fused[FUSE_LUI_ADDI]++;
+                break;
+            case OP_SLLI_ADD:
+                x[op.rd] = x[op.rs1] << (op.imm & 0x1F);
+                x[op.rd2] = x[op.rs1b] + x[op.rs2b];
+                fused[FUSE_SHIFT_ADD]++;
+                break;
+            case OP_ADDI_BEQ:
+            case OP_ADDI_BNE:
+            case OP_ADDI_BLT:
+            case OP_ADDI_BGE:
+            case OP_ADDI_BLTU:
+            case OP_ADDI_BGEU: {
+                x[op.rd] = x[op.rs1] + op.imm;
+                uint32_t a = x[op.rs1b];
+                uint32_t b = x[op.rs2b];
+                bool taken;
+                switch (op.kind) {
+                    case OP_ADDI_BEQ: taken = a == b; break;
+                    case OP_ADDI_BNE: taken = a != b; break;
+                    case OP_ADDI_BLT: taken = (int32_t)a < (int32_t)b; break;
+                    case OP_ADDI_BGE: taken = (int32_t)a >= (int32_t)b; break;
+                    case OP_ADDI_BLTU: taken = a < b; break;
+                    default: taken = a >= b; break;
+                }
+                if (taken) next = pc + 4 + op.imm2;
+                fused[FUSE_ADDI_BRANCH]++;
+                break;
+            }
+        }
+        x[0] = 0;
+        pc = next;
+    }
+
+    instructions += executed;
+    dispatches += dispatched;
+    seconds += (double)(clock() - start) / CLOCKS_PER_SEC;
+    return executed;
+}
+
+void Interpreter::printStatistics() const {
+    printf("\n==== Functional run (fast interpreter) ====\n");
+    printf("Instructions: %llu  Dispatches: %llu (%.1f%% fewer)\n", (unsigned long long)instructions,
+           (unsigned long long)dispatches,
+           instructions > 0 ? 100.0 * (instructions - dispatches) / instructions : 0.0);
+    printf("Fused pairs:");
+    for (int kind = FUSE_NONE + 1; kind < NUM_FUSION_KINDS; kind++) {
+        printf(" %s %llu (%u sites)%s", fusion_names[kind], (unsigned long long)fused[kind], fusedSites[kind],
+               kind + 1 < NUM_FUSION_KINDS ? "," : "\n");
+    }
+    if (seconds > 0) {
+        printf("Host time: %.2f ms (%.1f MIPS)\n", 1000.0 * seconds, instructions / seconds / 1e6);
+    }
+    for (int i = 1; i < NUM_REGISTERS; i++) {
+        if (intRegs[i] != 0) printf("x%-2d = 0x%08X\n", i, intRegs[i]);
+    }
+    for (int i = 0; i < NUM_REGISTERS; i++) {
+        if (float_bits(fpRegs[i]) != 0) printf("f%-2d = %g\n", i, fpRegs[i]);
+    }
+}
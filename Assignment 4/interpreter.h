@@ -0,0 +1,66 @@
+// interpreter.h
+#ifndef INTERPRETER_H
+#define INTERPRETER_H
+
+#include <cstdint>
+#include <vector>
+
+#include "core.h"
+#include "ram.h"
+
+// Functional fast path: runs a program with no timing at all. The code is decoded once into
+// handler records and adjacent idiom pairs are fused into single handlers (always on here),
+// so the inner loop is one switch dispatch per instruction or fused pair.
+class Interpreter {
+public:
+    // Code lives in [codeStart, codeEnd) of ram
+    Interpreter(RAM& ram, uint32_t codeStart, uint32_t codeEnd);
+
+    // Run from entry until the program leaves its code or halts; returns instructions executed
+    uint64_t run(uint32_t entry);
+
+    // Print the run summary and the non-zero registers
+    void printStatistics() const;
+
+    uint32_t intRegs[NUM_REGISTERS] = {};
+    float fpRegs[NUM_REGISTERS] = {};
+
+    uint64_t instructions = 0;
+    uint64_t dispatches = 0;
+    uint64_t fused[NUM_FUSION_KINDS] = {};      // Fused pairs executed, by kind
+    uint32_t fusedSites[NUM_FUSION_KINDS] = {}; // Adjacent pairs fused in the code, by kind
+    double seconds = 0.0;
+
+private:
+    // One decoded handler per code word; a fused handler at word i also covers word i + 1
+    struct Op {
+        uint8_t kind;
+        uint8_t length;             // Instructions covered
+        uint8_t rd, rs1, rs2, rs3;
+        uint8_t rd2, rs1b, rs2b;    // Second instruction of a fused pair
+        uint8_t funct3, funct7;     // Only the generic FP handler looks at these
+        int32_t imm;
+        int32_t imm2;
+    };
+
+    RAM& ram;
+    uint32_t codeStart;
+    uint32_t codeEnd;
+    std::vector<Op> ops;
+    bool halted = false;
+
+    // lr.w reservation: the word and its line's generation at the time
+    bool reservationValid = false;
+    uint32_t reservationAddress = 0;
+    uint32_t reservationGeneration = 0;
+
+    void predecode(uint32_t word);
+    FusionKind fuse(uint32_t word);
+    void invalidate(uint32_t address, uint32_t size);
+    void executeFp(const Op& op);
+    uint32_t load(uint32_t address, uint32_t size);
+    void store(uint32_t address, uint32_t value, uint32_t size);
+    uint32_t atomic(const Op& op, uint32_t address, uint32_t operand);
+};
+
+#endif // INTERPRETER_H
@@ -0,0 +1,56 @@
+// machine.cpp
+#include "machine.h"
+
+Machine::Machine(const CoreSetup &setup, const MachineOptions &options) : setup(setup), options(options) {}
+
+bool Machine::attach(CoreObserver *observer) {
+    if (core != nullptr) {
+        return false;   // The core was compiled without (or with a fixed set of) observers
+    }
+    setup.observers.push_back(observer);
+    return true;
+}
+
+bool Machine::start() {
+    if (core != nullptr) {
+        return true;
+    }
+    bool hooks = options.hooks || !setup.observers.empty();
+    const CorePreset *preset = find_core_preset(options.issue_width, hooks, options.caches, options.fp_unit,
+                                                options.counters, options.fusion);
+    if (preset == NULL) {
+        fprintf(stderr, "No pre-instantiated core for this combination of options\n");
+        print_core_presets(stderr);
+        return false;
+    }
+    core.reset(preset->create(setup));
+    return true;
+}
+
+uint64_t Machine::step(uint64_t cycles) {
+    return start() ? core->step(cycles) : 0;
+}
+
+bool Machine::run_until_pc(uint32_t pc) {
+    return start() && core->run_until_pc(pc);
+}
+
+bool Machine::run_until_tick(uint64_t tick) {
+    return start() && core->run_until_tick(tick);
+}
+
+bool Machine::run_until(const std::function<bool(const CoreModel &)> &predicate) {
+    return start() && core->run_until(predicate);
+}
+
+void Machine::run() {
+    if (start()) {
+        core->run();
+    }
+}
+
+void Machine::finish() {
+    if (core != nullptr) {
+        core->finish();
+    }
+}
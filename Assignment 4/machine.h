@@ -0,0 +1,60 @@
+// machine.h
+#ifndef MACHINE_H
+#define MACHINE_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+#include "core.h"
+#include "observer.h"
+
+// Features of the core to build; matched against the pre-instantiated configurations
+struct MachineOptions {
+    int issue_width = 2;
+    bool caches = true;
+    bool fp_unit = true;
+    bool counters = true;
+    bool fusion = false;
+    bool hooks = false;     // Build the core with hooks even without observers, e.g. to time its host phases
+};
+
+// Embedding API around a core: attach observers, then step it or run it to a stop condition.
+// The core is instantiated on the first step, with hooks compiled in only if observers were
+// attached by then (or options.hooks asks for them), so an unobserved machine runs the same code
+// as a plain simulation.
+class Machine {
+public:
+    Machine(const CoreSetup &setup, const MachineOptions &options);
+
+    // Report events to observer; only possible before the first step. The machine does not own it.
+    bool attach(CoreObserver *observer);
+
+    // Build the core; done implicitly by the first step. False (with a message) when no
+    // pre-instantiated configuration matches the options.
+    bool start();
+
+    // Simulate up to cycles cycles; returns how many ran
+    uint64_t step(uint64_t cycles = 1);
+    // Run until the end of the cycle in which the instruction at pc issues
+    bool run_until_pc(uint32_t pc);
+    // Run until simulation time reaches tick
+    bool run_until_tick(uint64_t tick);
+    // Run until predicate holds at the end of a cycle
+    bool run_until(const std::function<bool(const CoreModel &)> &predicate);
+    // Run to completion, drain memory and print the summary
+    void run();
+    // Drain memory and print the summary without running further (e.g. after stepping to the end)
+    void finish();
+
+    bool done() const { return core != nullptr && core->done(); }
+    // The core, once started (registers and counters)
+    const CoreModel *state() const { return core.get(); }
+
+private:
+    CoreSetup setup;
+    MachineOptions options;
+    std::unique_ptr<CoreModel> core;
+};
+
+#endif // MACHINE_H
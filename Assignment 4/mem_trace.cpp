@@ -0,0 +1,263 @@
+// mem_trace.cpp
+#include "mem_trace.h"
+#include "ram.h"
+#include "store_buffer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+
+namespace {
+
+const char TRACE_MAGIC[4] = {'R', 'V', 'M', 'T'};
+const uint8_t TRACE_VERSION = 1;
+const int MAX_CORES = 256;
+
+// Per core state the deltas are taken against
+struct DeltaState {
+    uint64_t tick;
+    uint32_t address;
+    uint32_t pc;
+};
+
+void putVarint(std::vector<uint8_t>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+uint64_t zigzag(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+int64_t unzigzag(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+// Bounds-checked reader over a loaded trace
+struct Cursor {
+    const uint8_t* data;
+    size_t size;
+    size_t position = 0;
+    bool truncated = false;
+
+    uint8_t byte() {
+        if (position >= size) {
+            truncated = true;
+            return 0;
+        }
+        return data[position++];
+    }
+
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint8_t next = byte();
+            value |= static_cast<uint64_t>(next & 0x7F) << shift;
+            if (!(next & 0x80)) break;
+        }
+        return value;
+    }
+};
+
+}  // namespace
+
+void TraceCapture::on_memory(const MemoryEvent& event) {
+    records.push_back({event.tick, event.address, event.pc, core, static_cast<uint8_t>(event.size), event.access});
+}
+
+bool writeTrace(const char* path, std::vector<TraceRecord> records) {
+    // Each core's records are already in tick order; a stable sort keeps them that way
+    std::stable_sort(records.begin(), records.end(),
+                     [](const TraceRecord& a, const TraceRecord& b) { return a.tick < b.tick; });
+
+    std::vector<uint8_t> out(TRACE_MAGIC, TRACE_MAGIC + sizeof(TRACE_MAGIC));
+    out.push_back(TRACE_VERSION);
+    putVarint(out, records.size());
+    out.reserve(out.size() + 4 * records.size());
+
+    DeltaState states[MAX_CORES] = {};
+    uint8_t lastCore = 0;
+    for (const TraceRecord& record : records) {
+        DeltaState& state = states[record.core];
+        uint8_t sizeCode = record.size == 4 ? 3 : record.size;  // 0 (fence), 1, 2 or 3
+        uint8_t tag = static_cast<uint8_t>(record.access) | sizeCode << 2;
+        if (record.core != lastCore) {
+            tag |= 0x10;
+        }
+        out.push_back(tag);
+        if (record.core != lastCore) {
+            putVarint(out, record.core);
+            lastCore = record.core;
+        }
+        putVarint(out, record.tick - state.tick);
+        if (record.access != ACCESS_FENCE) {
+            putVarint(out, zigzag(static_cast<int64_t>(record.address) - state.address));
+            state.address = record.address;
+        }
+        putVarint(out, zigzag(static_cast<int64_t>(record.pc) - state.pc));
+        state.tick = record.tick;
+        state.pc = record.pc;
+    }
+
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        perror(path);
+        return false;
+    }
+    bool written = fwrite(out.data(), 1, out.size(), file) == out.size();
+    written = fclose(file) == 0 && written;
+    if (!written) {
+        fprintf(stderr, "%s: write failed\n", path);
+    }
+    return written;
+}
+
+bool readTrace(const char* path, std::vector<TraceRecord>& records) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        perror(path);
+        return false;
+    }
+    std::vector<uint8_t> data;
+    uint8_t chunk[1 << 16];
+    size_t got;
+    while ((got = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        data.insert(data.end(), chunk, chunk + got);
+    }
+    fclose(file);
+
+    if (data.size() < sizeof(TRACE_MAGIC) + 1 || !std::equal(TRACE_MAGIC, TRACE_MAGIC + 4, data.begin()) ||
+        data[4] != TRACE_VERSION) {
+        fprintf(stderr, "%s: not a version %d memory trace\n", path, TRACE_VERSION);
+        return false;
+    }
+    Cursor cursor{data.data(), data.size(), 5};
+    uint64_t count = cursor.varint();
+    records.clear();
+    records.reserve(std::min<uint64_t>(count, data.size()));
+
+    DeltaState states[MAX_CORES] = {};
+    uint8_t core = 0;
+    for (uint64_t i = 0; i < count && !cursor.truncated; i++) {
+        uint8_t tag = cursor.byte();
+        if (tag & 0x10) {
+            core = static_cast<uint8_t>(cursor.varint());
+        }
+        DeltaState& state = states[core];
+        TraceRecord record;
+        record.core = core;
+        record.access = static_cast<MemoryAccess>(tag & 0x3);
+        record.size = (tag >> 2 & 0x3) == 3 ? 4 : tag >> 2 & 0x3;
+        state.tick += cursor.varint();
+        if (record.access != ACCESS_FENCE) {
+            state.address += static_cast<uint32_t>(unzigzag(cursor.varint()));
+        }
+        state.pc += static_cast<uint32_t>(unzigzag(cursor.varint()));
+        record.tick = state.tick;
+        record.address = record.access == ACCESS_FENCE ? 0 : state.address;
+        record.pc = state.pc;
+        records.push_back(record);
+    }
+    if (cursor.truncated) {
+        fprintf(stderr, "%s: truncated after %zu of %llu records\n", path, records.size() - 1,
+                (unsigned long long)count);
+        return false;
+    }
+    return true;
+}
+
+std::string ReplayConfig::label() const {
+    std::string text = "s" + std::to_string(storeBufferDepth) + " " + prefetcher;
+    if (prefetcher != "none") {
+        text += ":" + std::to_string(prefetch.degree) + ":" + std::to_string(prefetch.distance);
+    }
+    return text;
+}
+
+bool replayTrace(const std::vector<TraceRecord>& records, const ReplayConfig& config, ReplayResult& result) {
+    int cores = 0;
+    for (const TraceRecord& record : records) {
+        cores = std::max(cores, record.core + 1);
+    }
+
+    RAM ram;    // Scratch memory: the buffers need somewhere to write, only the timing matters
+    std::vector<std::unique_ptr<StoreBuffer>> buffers;
+    std::vector<std::unique_ptr<PrefetchUnit>> units;
+    for (int core = 0; core < cores; core++) {
+        buffers.emplace_back(new StoreBuffer(ram, config.storeBufferDepth));
+        if (config.prefetcher != "none") {
+            Prefetcher* prefetcher = PrefetchUnit::create(config.prefetcher, config.prefetch);
+            if (prefetcher == nullptr) {
+                fprintf(stderr, "Unknown prefetcher '%s'\n", config.prefetcher.c_str());
+                return false;
+            }
+            units.emplace_back(new PrefetchUnit(ram, prefetcher));
+            buffers.back()->attachPrefetcher(units.back().get());
+        }
+    }
+
+    result = ReplayResult();
+    std::vector<uint64_t> lastTick(cores, 0);
+    auto start = std::chrono::steady_clock::now();
+    for (const TraceRecord& record : records) {
+        StoreBuffer& buffer = *buffers[record.core];
+        uint64_t tick = record.tick;
+        uint64_t now = tick;
+        try {
+            switch (record.access) {
+                case ACCESS_READ:
+                    buffer.read(record.address, now, record.size, record.pc);
+                    result.loads++;
+                    result.loadTicks += now - tick;
+                    break;
+                case ACCESS_WRITE:
+                    buffer.write(record.address, 0, now, record.size);
+                    result.stores++;
+                    result.storeStallTicks += now - tick;
+                    break;
+                case ACCESS_ATOMIC:
+                case ACCESS_FENCE:
+                    // Atomics drain the buffer like fences, then pay the same RAM latency everywhere
+                    buffer.drain(now);
+                    (record.access == ACCESS_ATOMIC ? result.atomics : result.fences)++;
+                    result.drainTicks += now - tick;
+                    break;
+            }
+        } catch (const std::out_of_range&) {
+            // The core halted on this access; nothing to model
+        }
+        lastTick[record.core] = now;
+    }
+    for (int core = 0; core < cores; core++) {
+        uint64_t now = lastTick[core];
+        buffers[core]->drain(now);
+        result.drainTicks += now - lastTick[core];
+        result.forwardedLoads += buffers[core]->forwardedLoads;
+        result.lineWrites += buffers[core]->lineWrites;
+    }
+    for (const auto& unit : units) {
+        result.prefetchHits += unit->timelyHits + unit->lateHits;
+        result.prefetchesIssued += unit->issued;
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return true;
+}
+
+void printReplayHeader(FILE* out) {
+    fprintf(out, "%-18s %9s %9s %9s %11s %11s %11s %9s %9s %9s\n", "config", "loads", "stores", "load avg",
+            "store stall", "drain", "mem ticks", "forwarded", "pf hits", "pf issued");
+}
+
+void printReplayRow(FILE* out, const ReplayConfig& config, const ReplayResult& result) {
+    uint64_t total = result.loadTicks + result.storeStallTicks + result.drainTicks;
+    fprintf(out, "%-18s %9llu %9llu %9.2f %11llu %11llu %11llu %9llu %9llu %9llu\n", config.label().c_str(),
+            (unsigned long long)result.loads, (unsigned long long)result.stores,
+            result.loads > 0 ? (double)result.loadTicks / result.loads : 0.0,
+            (unsigned long long)result.storeStallTicks, (unsigned long long)result.drainTicks,
+            (unsigned long long)total, (unsigned long long)result.forwardedLoads,
+            (unsigned long long)result.prefetchHits, (unsigned long long)result.prefetchesIssued);
+}
@@ -0,0 +1,86 @@
+// mem_trace.h
+#ifndef MEM_TRACE_H
+#define MEM_TRACE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "observer.h"
+#include "prefetcher.h"
+
+// One data port access of a core
+struct TraceRecord {
+    uint64_t tick;          // Simulation time the core issued it
+    uint32_t address;       // 0 for fences
+    uint32_t pc;            // Instruction making it; the stride prefetcher is indexed by it
+    uint8_t core;           // Hart that made it
+    uint8_t size;           // 1, 2 or 4 bytes; 0 for fences
+    MemoryAccess access;
+};
+
+// Records the demand accesses of one core, above the store buffer and prefetcher, so a trace
+// can be replayed through any memory hierarchy configuration. Attach one per hart.
+class TraceCapture : public CoreObserver {
+public:
+    explicit TraceCapture(int core) : core(static_cast<uint8_t>(core)) {}
+
+    void on_memory(const MemoryEvent& event) override;
+
+    std::vector<TraceRecord> records;
+
+private:
+    uint8_t core;
+};
+
+// Binary trace file: the magic "RVMT", a version byte and a varint record count, then per
+// record a tag byte (access kind in bits 0-1, log2(size) + 1 in bits 2-3, bit 4 set when a
+// varint core number follows) and varint deltas against the previous record of the same core:
+// tick, then zigzag address and zigzag pc. A record takes about 5 bytes
+// (instruct.s: 775 records in 3878 bytes).
+
+// Merge the records of all cores in tick order and write them to path; false (with a message)
+// when the file cannot be written
+bool writeTrace(const char* path, std::vector<TraceRecord> records);
+
+// Read a whole trace; false (with a message) for a missing, foreign or truncated file
+bool readTrace(const char* path, std::vector<TraceRecord>& records);
+
+// Memory hierarchy a trace is replayed through
+struct ReplayConfig {
+    int storeBufferDepth;
+    std::string prefetcher;         // "none", "next", "stride" or "stream"
+    PrefetchConfig prefetch;
+
+    // e.g. "s4 stride:2:4"
+    std::string label() const;
+};
+
+// What one replay measured, summed over the cores
+struct ReplayResult {
+    uint64_t loads = 0;
+    uint64_t stores = 0;
+    uint64_t atomics = 0;
+    uint64_t fences = 0;
+    uint64_t loadTicks = 0;         // Latency of all loads
+    uint64_t storeStallTicks = 0;   // Stores waiting for a free store buffer entry
+    uint64_t drainTicks = 0;        // Fences, atomics and the final drain waiting for buffered stores
+    uint64_t forwardedLoads = 0;
+    uint64_t lineWrites = 0;
+    uint64_t prefetchHits = 0;      // Timely and late
+    uint64_t prefetchesIssued = 0;
+    double seconds = 0.0;           // Host time the replay took
+};
+
+// Feed the records through one store buffer (and prefetch unit) per core, each access at the
+// tick it was captured at. The replay is open loop: a slower hierarchy does not push later
+// accesses back, so compare configurations by the latencies they add up, not by run time.
+// False (with a message) when the prefetcher is unknown.
+bool replayTrace(const std::vector<TraceRecord>& records, const ReplayConfig& config, ReplayResult& result);
+
+// One table row per replay
+void printReplayHeader(FILE* out);
+void printReplayRow(FILE* out, const ReplayConfig& config, const ReplayResult& result);
+
+#endif // MEM_TRACE_H
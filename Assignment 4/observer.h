@@ -0,0 +1,79 @@
+// observer.h
+#ifndef OBSERVER_H
+#define OBSERVER_H
+
+#include <cstdint>
+#include <cstdio>
+
+// Front-end events: an instruction entered the fetch queue or was dropped from it by a redirect
+typedef enum {
+    STAGE_FETCH,
+    STAGE_SQUASH
+} PipelineStage;
+
+typedef struct {
+    uint64_t cycle;
+    PipelineStage stage;
+    uint32_t pc;
+    uint32_t instruction;
+} StageEvent;
+
+// An instruction issued and executed (this model retires at issue)
+typedef struct {
+    uint64_t cycle;
+    int slot;
+    uint32_t pc;
+    uint32_t instruction;
+    bool fused;         // Second half of a pair issued in the same slot
+} RetireEvent;
+
+// Kinds of data port access
+typedef enum {
+    ACCESS_READ,
+    ACCESS_WRITE,
+    ACCESS_ATOMIC,      // lr.w / sc.w / amo*.w on shared RAM
+    ACCESS_FENCE        // Wait for the store buffer to drain; no address or value
+} MemoryAccess;
+
+// A data port access
+typedef struct {
+    uint64_t cycle;
+    uint64_t tick;      // Simulation time the access started
+    uint32_t pc;        // Instruction making the access
+    uint32_t address;
+    uint32_t value;
+    int size;
+    MemoryAccess access;
+    int latency;        // Ticks it cost
+} MemoryEvent;
+
+// Hooks into a running core. Override what you need; a core only compiles the hook calls in when
+// it is built with observers (CoreConfig::HOOKS), so unobserved runs pay nothing for them.
+class CoreObserver {
+public:
+    virtual ~CoreObserver() {}
+    virtual void on_stage(const StageEvent &) {}
+    virtual void on_retire(const RetireEvent &) {}
+    virtual void on_memory(const MemoryEvent &) {}
+    // End of a cycle; ticks is the simulation time at that point
+    virtual void on_cycle(uint64_t, uint64_t) {}
+};
+
+// The classic per-cycle trace: fetches, issues and the tick count
+class TracePrinter : public CoreObserver {
+public:
+    void on_stage(const StageEvent &event) override {
+        if (event.stage == STAGE_FETCH) {
+            printf("Fetched instruction: 0x%08X at PC: 0x%08X\n", event.instruction, event.pc);
+        }
+    }
+    void on_retire(const RetireEvent &event) override {
+        printf("Cycle %llu slot %d: issued 0x%08X at PC 0x%08X%s\n", (unsigned long long)event.cycle,
+               event.slot, event.instruction, event.pc, event.fused ? " (fused)" : "");
+    }
+    void on_cycle(uint64_t, uint64_t ticks) override {
+        printf("Simulation ticks: %llu\n", (unsigned long long)ticks);
+    }
+};
+
+#endif // OBSERVER_H
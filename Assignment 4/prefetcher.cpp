@@ -0,0 +1,237 @@
+// prefetcher.cpp
+#include "prefetcher.h"
+#include <cstdio>
+
+namespace {
+
+int64_t lineOf(uint32_t address) {
+    return address / RAM::LINE_SIZE;
+}
+
+} // namespace
+
+// Next-line: the lines following the one just touched
+void NextLinePrefetcher::observe(uint32_t, uint32_t address, std::vector<uint32_t>& candidates) {
+    int64_t line = lineOf(address);
+    for (int i = 0; i < config.degree; i++) {
+        candidates.push_back(static_cast<uint32_t>((line + config.distance + i) * RAM::LINE_SIZE));
+    }
+}
+
+StridePrefetcher::StridePrefetcher(const PrefetchConfig& config) : Prefetcher(config) {
+    for (Entry& entry : table) {
+        entry.valid = false;
+    }
+}
+
+// Reference prediction table: two matching strides in a row make an entry steady
+void StridePrefetcher::observe(uint32_t pc, uint32_t address, std::vector<uint32_t>& candidates) {
+    Entry& entry = table[(pc >> 2) % TABLE_SIZE];
+    if (!entry.valid || entry.pc != pc) {
+        entry = {true, pc, address, 0, INITIAL};
+        return;
+    }
+
+    int32_t stride = static_cast<int32_t>(address - entry.lastAddress);
+    bool correct = stride == entry.stride;
+    switch (entry.state) {
+        case INITIAL:
+            entry.state = correct ? STEADY : TRANSIENT;
+            break;
+        case TRANSIENT:
+            entry.state = correct ? STEADY : NO_PREDICTION;
+            break;
+        case STEADY:
+            entry.state = correct ? STEADY : INITIAL;
+            break;
+        case NO_PREDICTION:
+            entry.state = correct ? TRANSIENT : NO_PREDICTION;
+            break;
+    }
+    if (!correct && entry.state != INITIAL) {
+        entry.stride = stride;      // A steady entry keeps its stride for one miss
+    }
+    entry.lastAddress = address;
+
+    if (entry.state == STEADY && entry.stride != 0) {
+        // Distance and degree are in lines: run at least distance lines ahead and fetch one new
+        // line per degree step, both rounded up to whole strides
+        int64_t stride = entry.stride;
+        int64_t magnitude = stride < 0 ? -stride : stride;
+        int64_t ahead = (config.distance * static_cast<int64_t>(RAM::LINE_SIZE) + magnitude - 1) / magnitude;
+        int64_t step = (static_cast<int64_t>(RAM::LINE_SIZE) + magnitude - 1) / magnitude;
+        for (int i = 0; i < config.degree; i++) {
+            int64_t target = static_cast<int64_t>(address) + stride * (ahead + step * i);
+            if (target >= 0) {
+                candidates.push_back(static_cast<uint32_t>(target));
+            }
+        }
+    }
+}
+
+StreamPrefetcher::StreamPrefetcher(const PrefetchConfig& config) : Prefetcher(config) {
+    for (Stream& stream : streams) {
+        stream.valid = false;
+    }
+}
+
+// Follow runs of consecutive lines; unmatched lines start a new tracker in the LRU slot
+void StreamPrefetcher::observe(uint32_t, uint32_t address, std::vector<uint32_t>& candidates) {
+    int64_t line = lineOf(address);
+    accesses++;
+
+    Stream* match = nullptr;
+    for (Stream& stream : streams) {
+        if (!stream.valid) continue;
+        int64_t delta = line - stream.lastLine;
+        if (delta == 0) {
+            match = &stream;
+            break;
+        }
+        if ((stream.direction == 0 && (delta == 1 || delta == -1)) ||
+            (stream.direction != 0 && delta == stream.direction)) {
+            stream.direction = static_cast<int>(delta);
+            stream.lastLine = line;
+            stream.confidence++;
+            match = &stream;
+            break;
+        }
+    }
+
+    if (match == nullptr) {
+        Stream* victim = &streams[0];
+        for (Stream& stream : streams) {
+            if (!stream.valid) {
+                victim = &stream;
+                break;
+            }
+            if (stream.lastUse < victim->lastUse) victim = &stream;
+        }
+        *victim = {true, line, 0, 0, accesses};
+        return;
+    }
+
+    match->lastUse = accesses;
+    if (match->confidence >= CONFIRMATIONS) {
+        for (int i = 0; i < config.degree; i++) {
+            int64_t target = line + match->direction * (config.distance + i);
+            if (target >= 0) {
+                candidates.push_back(static_cast<uint32_t>(target * RAM::LINE_SIZE));
+            }
+        }
+    }
+}
+
+// Constructor: the buffer starts empty
+PrefetchUnit::PrefetchUnit(RAM& ram, Prefetcher* prefetcher, bool demandFill, int entries)
+    : ram(ram), prefetcher(prefetcher), demandFill(demandFill), lines(entries > 0 ? entries : 1) {
+    for (Line& line : lines) {
+        line.valid = false;
+    }
+}
+
+PrefetchUnit::~PrefetchUnit() {
+    delete prefetcher;
+}
+
+Prefetcher* PrefetchUnit::create(const std::string& kind, const PrefetchConfig& config) {
+    if (kind == "none") return new NoPrefetcher(config);
+    if (kind == "next") return new NextLinePrefetcher(config);
+    if (kind == "stride") return new StridePrefetcher(config);
+    if (kind == "stream") return new StreamPrefetcher(config);
+    return nullptr;
+}
+
+// Demand load through the prefetch buffer, then let the prefetcher train on it
+uint32_t PrefetchUnit::read(uint32_t pc, uint32_t address, uint64_t& tickCounter, uint32_t size) {
+    uint64_t dataTicks = 0;
+    uint32_t value = ram.read(address, dataTicks, size);   // Throws on out of range like RAM::read
+    uint64_t issueTick = tickCounter;
+
+    demandReads++;
+    uint32_t lineAddress = address & ~(RAM::LINE_SIZE - 1);
+    Line* line = find(lineAddress);
+    if (line == nullptr) {
+        misses++;
+        tickCounter += RAM::READ_LATENCY;
+        if (demandFill) {
+            allocate(lineAddress, false, tickCounter);
+        }
+    } else if (!line->prefetched) {
+        lineHits++;
+        line->lastUse = ++useCounter;
+        if (line->readyTick > tickCounter) {
+            tickCounter = line->readyTick;
+        }
+    } else {
+        if (!line->used) {
+            useful++;
+            line->used = true;
+        }
+        line->lastUse = ++useCounter;
+        if (line->readyTick <= tickCounter) {
+            timelyHits++;
+            ticksSaved += RAM::READ_LATENCY;
+        } else {
+            lateHits++;
+            ticksSaved += RAM::READ_LATENCY - (line->readyTick - tickCounter);
+            tickCounter = line->readyTick;
+        }
+    }
+
+    candidates.clear();
+    prefetcher->observe(pc, address, candidates);
+    for (uint32_t candidate : candidates) {
+        uint32_t candidateLine = candidate & ~(RAM::LINE_SIZE - 1);
+        if (candidateLine + RAM::LINE_SIZE <= RAM::RAM_SIZE && find(candidateLine) == nullptr) {
+            issue(candidateLine, issueTick);
+        }
+    }
+    return value;
+}
+
+PrefetchUnit::Line* PrefetchUnit::find(uint32_t lineAddress) {
+    for (Line& line : lines) {
+        if (line.valid && line.lineAddress == lineAddress) return &line;
+    }
+    return nullptr;
+}
+
+// Take the least recently used line for lineAddress
+PrefetchUnit::Line* PrefetchUnit::allocate(uint32_t lineAddress, bool prefetched, uint64_t readyTick) {
+    Line* victim = &lines[0];
+    for (Line& line : lines) {
+        if (!line.valid) {
+            victim = &line;
+            break;
+        }
+        if (line.lastUse < victim->lastUse) victim = &line;
+    }
+    if (victim->valid && victim->prefetched && !victim->used) {
+        evictedUnused++;
+    }
+    *victim = {true, prefetched, false, lineAddress, readyTick, ++useCounter};
+    return victim;
+}
+
+// Send a prefetch to RAM
+void PrefetchUnit::issue(uint32_t lineAddress, uint64_t tick) {
+    allocate(lineAddress, true, tick + RAM::READ_LATENCY);
+    issued++;
+}
+
+// Accuracy: useful / issued. Coverage: demand reads that would have gone to RAM served by a prefetch.
+// Timeliness: prefetch hits whose line had fully arrived.
+void PrefetchUnit::printStatistics() const {
+    uint64_t hits = timelyHits + lateHits;
+    printf("Prefetcher (%s): demand reads %llu, hits %llu (late %llu), line hits %llu, misses %llu\n",
+           prefetcher->name(), (unsigned long long)demandReads, (unsigned long long)hits,
+           (unsigned long long)lateHits, (unsigned long long)lineHits, (unsigned long long)misses);
+    printf("  issued %llu, useful %llu, evicted unused %llu, RAM ticks hidden %llu\n",
+           (unsigned long long)issued, (unsigned long long)useful, (unsigned long long)evictedUnused,
+           (unsigned long long)ticksSaved);
+    printf("  accuracy %.1f%%, coverage %.1f%%, timeliness %.1f%%\n",
+           issued ? 100.0 * useful / issued : 0.0,
+           hits + misses ? 100.0 * hits / (hits + misses) : 0.0,
+           hits ? 100.0 * timelyHits / hits : 0.0);
+}
@@ -0,0 +1,151 @@
+// prefetcher.h
+#ifndef PREFETCHER_H
+#define PREFETCHER_H
+
+#include "ram.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Tuning shared by all prefetchers. Distance and degree count lines; the stride prefetcher
+// rounds them up to whole strides so its prefetches land on addresses the load will touch.
+struct PrefetchConfig {
+    int degree = 1;         // Prefetches issued per trigger
+    int distance = 1;       // How far ahead of the demand access the first prefetch lands
+};
+
+// A prefetcher watches the demand load stream and proposes addresses to fetch early
+class Prefetcher {
+public:
+    explicit Prefetcher(const PrefetchConfig& config) : config(config) {}
+    virtual ~Prefetcher() {}
+
+    virtual const char* name() const = 0;
+
+    // Observe a demand load from pc to address; append prefetch addresses to candidates
+    virtual void observe(uint32_t pc, uint32_t address, std::vector<uint32_t>& candidates) = 0;
+
+protected:
+    PrefetchConfig config;
+};
+
+// No prefetching; lets a PrefetchUnit run as a plain demand-filled line buffer
+class NoPrefetcher : public Prefetcher {
+public:
+    explicit NoPrefetcher(const PrefetchConfig& config) : Prefetcher(config) {}
+    const char* name() const override { return "none"; }
+    void observe(uint32_t, uint32_t, std::vector<uint32_t>&) override {}
+};
+
+// Next-line: every access to line L asks for lines L + distance ... L + distance + degree - 1
+class NextLinePrefetcher : public Prefetcher {
+public:
+    explicit NextLinePrefetcher(const PrefetchConfig& config) : Prefetcher(config) {}
+    const char* name() const override { return "next-line"; }
+    void observe(uint32_t pc, uint32_t address, std::vector<uint32_t>& candidates) override;
+};
+
+// Per-PC stride prefetcher: a reference prediction table (Chen & Baer) indexed by the load's PC
+class StridePrefetcher : public Prefetcher {
+public:
+    static const int TABLE_SIZE = 16;
+
+    explicit StridePrefetcher(const PrefetchConfig& config);
+    const char* name() const override { return "stride"; }
+    void observe(uint32_t pc, uint32_t address, std::vector<uint32_t>& candidates) override;
+
+private:
+    enum State { INITIAL, TRANSIENT, STEADY, NO_PREDICTION };
+
+    struct Entry {
+        bool valid;
+        uint32_t pc;
+        uint32_t lastAddress;
+        int32_t stride;
+        State state;
+    };
+
+    Entry table[TABLE_SIZE];
+};
+
+// Stream prefetcher: trackers lock onto ascending / descending runs of consecutive lines
+// and, once confirmed, run ahead of them
+class StreamPrefetcher : public Prefetcher {
+public:
+    static const int NUM_STREAMS = 4;
+    static const int CONFIRMATIONS = 2;    // Consecutive lines seen before prefetching starts
+
+    explicit StreamPrefetcher(const PrefetchConfig& config);
+    const char* name() const override { return "stream"; }
+    void observe(uint32_t pc, uint32_t address, std::vector<uint32_t>& candidates) override;
+
+private:
+    struct Stream {
+        bool valid;
+        int64_t lastLine;
+        int direction;      // +1 / -1, 0 while unknown
+        int confidence;
+        uint64_t lastUse;
+    };
+
+    Stream streams[NUM_STREAMS];
+    uint64_t accesses = 0;
+};
+
+// Prefetch buffer on the load path to RAM. Prefetched lines are tracked with the tick their data
+// arrives; the buffer only models timing, the data itself is always read from RAM. With demandFill
+// the lines demand misses fetch are kept as well, which makes the buffer a small load cache: turn
+// it on for the baseline (prefetcher "none") too, or the prefetcher gets the credit for the caching.
+class PrefetchUnit {
+public:
+    static const int DEFAULT_ENTRIES = 16;
+
+    // Takes ownership of the prefetcher
+    PrefetchUnit(RAM& ram, Prefetcher* prefetcher, bool demandFill = false, int entries = DEFAULT_ENTRIES);
+    ~PrefetchUnit();
+    PrefetchUnit(const PrefetchUnit&) = delete;
+    PrefetchUnit& operator=(const PrefetchUnit&) = delete;
+
+    // Build a prefetcher by name: "none", "next", "stride" or "stream"; nullptr for anything else
+    static Prefetcher* create(const std::string& kind, const PrefetchConfig& config);
+
+    // Demand load: free on a buffer hit, the remaining wait on a late line, RAM latency otherwise.
+    // With demandFill a miss fills its line into the buffer.
+    uint32_t read(uint32_t pc, uint32_t address, uint64_t& tickCounter, uint32_t size = 4);
+
+    // Print accuracy / coverage / timeliness
+    void printStatistics() const;
+
+    uint64_t demandReads = 0;
+    uint64_t timelyHits = 0;        // Line had already arrived
+    uint64_t lateHits = 0;          // Line was still on its way
+    uint64_t lineHits = 0;          // Hits on lines an earlier demand miss filled (demandFill only)
+    uint64_t misses = 0;
+    uint64_t issued = 0;            // Prefetches sent to RAM
+    uint64_t useful = 0;            // Prefetched lines hit at least once
+    uint64_t evictedUnused = 0;
+    uint64_t ticksSaved = 0;        // RAM latency hidden from demand loads
+
+private:
+    struct Line {
+        bool valid;
+        bool prefetched;    // Filled by a prefetch rather than a demand miss
+        bool used;
+        uint32_t lineAddress;
+        uint64_t readyTick;
+        uint64_t lastUse;
+    };
+
+    RAM& ram;
+    Prefetcher* prefetcher;
+    bool demandFill;
+    std::vector<Line> lines;
+    std::vector<uint32_t> candidates;
+    uint64_t useCounter = 0;
+
+    Line* find(uint32_t lineAddress);
+    Line* allocate(uint32_t lineAddress, bool prefetched, uint64_t readyTick);
+    void issue(uint32_t lineAddress, uint64_t tick);
+};
+
+#endif // PREFETCHER_H
@@ -0,0 +1,374 @@
+// profiler.cpp
+#include "profiler.h"
+#include "core.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+namespace {
+
+uint16_t read16(const std::vector<uint8_t>& bytes, size_t offset) {
+    return static_cast<uint16_t>(bytes[offset] | (bytes[offset + 1] << 8));
+}
+
+uint32_t read32(const std::vector<uint8_t>& bytes, size_t offset) {
+    return static_cast<uint32_t>(bytes[offset]) | (static_cast<uint32_t>(bytes[offset + 1]) << 8) |
+           (static_cast<uint32_t>(bytes[offset + 2]) << 16) | (static_cast<uint32_t>(bytes[offset + 3]) << 24);
+}
+
+bool isBlockLabel(const std::string& name) {
+    return name.size() > 2 && name[0] == '.' && name[1] == 'L';
+}
+
+double percent(uint64_t part, uint64_t whole) {
+    return whole > 0 ? 100.0 * part / whole : 0.0;
+}
+
+} // namespace
+
+// Constructor: tables cover [textStart, textEnd) one entry per instruction word
+Profiler::Profiler(const uint8_t* code, uint32_t textStart, uint32_t textEnd, int samplePeriod,
+                   const char* const* stallNames, int numStallReasons)
+    : code(code), textStart(textStart), textEnd(textEnd < textStart ? textStart : textEnd),
+      samplePeriod(samplePeriod < 0 ? 0 : samplePeriod), stallNames(stallNames),
+      numStallReasons(numStallReasons) {
+    size_t words = (this->textEnd - textStart + 3) / 4;
+    executions.assign(words, 0);
+    cycles.assign(words, 0);
+    stalls.assign(words * numStallReasons, 0);
+    caused.assign(words, 0);
+    countdown = exact() ? 1 : this->samplePeriod;
+    interval = countdown;
+}
+
+void Profiler::addSymbol(const std::string& name, uint32_t address) {
+    symbols.push_back({name, address, !isBlockLabel(name)});
+}
+
+void Profiler::addSymbols(const std::unordered_map<std::string, uint32_t>& table) {
+    for (const auto& symbol : table) {
+        addSymbol(symbol.first, symbol.second);
+    }
+}
+
+// Pick the function and untyped symbols out of .symtab; section-relative values are taken
+// as absolute, which holds for objects linked (or assembled) at address 0
+bool Profiler::loadElfSymbols(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        std::fprintf(stderr, "Cannot open %s\n", path.c_str());
+        return false;
+    }
+    std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (bytes.size() < 52 || std::memcmp(bytes.data(), "\x7F" "ELF", 4) != 0 || bytes[4] != 1 || bytes[5] != 1) {
+        std::fprintf(stderr, "%s is not a 32-bit little-endian ELF file\n", path.c_str());
+        return false;
+    }
+
+    uint32_t sectionOffset = read32(bytes, 32);
+    uint16_t sectionSize = read16(bytes, 46);
+    uint16_t sectionCount = read16(bytes, 48);
+    if (sectionSize < 40 || sectionOffset + static_cast<uint64_t>(sectionSize) * sectionCount > bytes.size()) {
+        std::fprintf(stderr, "%s: bad section header table\n", path.c_str());
+        return false;
+    }
+
+    int found = 0;
+    for (uint16_t s = 0; s < sectionCount; s++) {
+        size_t header = sectionOffset + static_cast<size_t>(s) * sectionSize;
+        if (read32(bytes, header + 4) != 2) continue;      // SHT_SYMTAB
+        uint32_t offset = read32(bytes, header + 16);
+        uint32_t size = read32(bytes, header + 20);
+        uint32_t link = read32(bytes, header + 24);
+        uint32_t entrySize = read32(bytes, header + 36);
+        if (link >= sectionCount || entrySize < 16 || static_cast<uint64_t>(offset) + size > bytes.size()) continue;
+        size_t stringHeader = sectionOffset + static_cast<size_t>(link) * sectionSize;
+        uint32_t strings = read32(bytes, stringHeader + 16);
+        uint32_t stringsSize = read32(bytes, stringHeader + 20);
+        if (static_cast<uint64_t>(strings) + stringsSize > bytes.size()) continue;
+
+        for (uint32_t entry = offset; entry + entrySize <= offset + size; entry += entrySize) {
+            uint32_t name = read32(bytes, entry);
+            uint32_t value = read32(bytes, entry + 4);
+            uint8_t type = bytes[entry + 12] & 0xF;
+            if ((type != 0 && type != 2) || name == 0 || name >= stringsSize) continue;    // STT_NOTYPE / STT_FUNC
+            const char* text = reinterpret_cast<const char*>(bytes.data() + strings + name);
+            size_t length = strnlen(text, stringsSize - name);
+            std::string symbol(text, length);
+            if (symbol.empty() || symbol[0] == '$') continue;       // Mapping symbols
+            addSymbol(symbol, value);
+            found++;
+        }
+    }
+    if (found == 0) {
+        std::fprintf(stderr, "%s: no usable symbols\n", path.c_str());
+    }
+    return found > 0;
+}
+
+// Sort the symbols, split the code into basic blocks and open the entry frame
+void Profiler::start(uint32_t entry) {
+    std::stable_sort(symbols.begin(), symbols.end(), [](const Symbol& a, const Symbol& b) {
+        return a.address != b.address ? a.address < b.address : a.function > b.function;
+    });
+
+    size_t words = executions.size();
+    functionNames.assign(1, "[unknown]");
+    functionAt.assign(words, 0);
+    labelAt.assign(words, -1);
+    std::vector<bool> leader(words + 1, false);
+    if (words > 0) leader[0] = true;
+    if (inText(entry)) leader[index(entry)] = true;
+
+    int function = 0;
+    int label = -1;
+    size_t next = 0;
+    for (size_t w = 0; w < words; w++) {
+        uint32_t pc = textStart + static_cast<uint32_t>(w) * 4;
+        for (; next < symbols.size() && symbols[next].address <= pc; next++) {
+            const Symbol& symbol = symbols[next];
+            if (symbol.address < textStart) continue;
+            // Sorting put functions first among symbols sharing an address: the first function
+            // names the code, a block label after it names the location
+            bool sameAddress = label >= 0 && symbols[label].address == symbol.address;
+            if (symbol.function && !(sameAddress && symbols[label].function)) {
+                functionNames.push_back(symbol.name);
+                function = static_cast<int>(functionNames.size()) - 1;
+            }
+            if (!sameAddress || !symbol.function) {
+                label = static_cast<int>(next);
+            }
+            if (symbol.address == pc) leader[w] = true;
+        }
+        functionAt[w] = function;
+        labelAt[w] = label;
+
+        // Control flow ends a block; branch and jal targets start one
+        DecodedInstr d;
+        uint32_t instruction;
+        std::memcpy(&instruction, code + pc, sizeof(instruction));
+        decode(instruction, pc, &d);
+        if (d.opcode == OPCODE_BRANCH || d.opcode == OPCODE_JAL || d.opcode == OPCODE_JALR) {
+            leader[w + 1] = true;
+            uint32_t target = pc + d.imm;
+            if (d.opcode != OPCODE_JALR && inText(target)) leader[index(target)] = true;
+        }
+    }
+
+    blocks.clear();
+    for (size_t w = 0; w < words; w++) {
+        if (!leader[w]) continue;
+        size_t end = w + 1;
+        while (end < words && !leader[end]) end++;
+        blocks.push_back({textStart + static_cast<uint32_t>(w) * 4, textStart + static_cast<uint32_t>(end) * 4});
+    }
+
+    nodes.clear();
+    nodes.push_back({-1, nullptr, {}, 0});
+    callStack.assign(1, child(&nodes.front(), inText(entry) ? functionAt[index(entry)] : 0));
+    leafCache = nullptr;
+}
+
+// Calls push the callee's frame, returns pop back to the caller
+void Profiler::jump(uint32_t, uint32_t target, uint32_t rd, uint32_t rs1, bool indirect) {
+    bool link = rd == 1 || rd == 5;
+    if (link) {
+        callStack.push_back(child(callStack.back(), inText(target) ? functionAt[index(target)] : 0));
+    } else if (indirect && rd == 0 && (rs1 == 1 || rs1 == 5) && callStack.size() > 1) {
+        callStack.pop_back();
+    }
+    leafCache = nullptr;
+}
+
+Profiler::CallNode* Profiler::child(CallNode* parent, int function) {
+    for (CallNode* node : parent->children) {
+        if (node->function == function) return node;
+    }
+    nodes.push_back({function, parent, {}, 0});
+    parent->children.push_back(&nodes.back());
+    return &nodes.back();
+}
+
+// The frame a sample at pc lands in: the top of the call stack, or a sibling of it when the
+// program jumped into another function without a call
+Profiler::CallNode* Profiler::leafFor(uint32_t pc) {
+    int function = inText(pc) ? functionAt[index(pc)] : 0;
+    if (leafCache != nullptr && leafCacheFunction == function) {
+        return leafCache;
+    }
+    CallNode* top = callStack.back();
+    leafCache = top->function == function ? top : child(top->parent, function);
+    leafCacheFunction = function;
+    return leafCache;
+}
+
+// Charge the cycles since the last sample; sampling mode draws the next interval around the period
+void Profiler::sample(uint32_t pc, int stallReason, uint32_t blamePc) {
+    uint64_t weight = static_cast<uint64_t>(interval);
+    if (exact()) {
+        countdown = 1;
+    } else {
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        // Jitter of +-1/4 period keeps the average and breaks up aliasing with loop lengths
+        countdown = samplePeriod - samplePeriod / 4 + static_cast<int>(rng % (samplePeriod / 2 + 1));
+        if (countdown < 1) countdown = 1;
+    }
+    interval = countdown;
+    totalCycles += weight;
+    samples++;
+
+    if (inText(pc)) {
+        uint32_t i = index(pc);
+        cycles[i] += weight;
+        if (stallReason != NO_STALL) {
+            stalls[i * numStallReasons + stallReason] += weight;
+        }
+    }
+    if (blamePc != NO_PC && inText(blamePc)) {
+        caused[index(blamePc)] += weight;
+    }
+    leafFor(pc)->cycles += weight;
+}
+
+// Nearest symbol plus offset, or the bare address without symbols
+std::string Profiler::location(uint32_t pc) const {
+    char text[96];
+    int label = inText(pc) ? labelAt[index(pc)] : -1;
+    if (label < 0) {
+        std::snprintf(text, sizeof(text), "0x%08X", pc);
+    } else if (symbols[label].address == pc) {
+        std::snprintf(text, sizeof(text), "%s", symbols[label].name.c_str());
+    } else {
+        std::snprintf(text, sizeof(text), "%s+0x%X", symbols[label].name.c_str(), pc - symbols[label].address);
+    }
+    return text;
+}
+
+void Profiler::printReport(FILE* out, int top) const {
+    uint64_t stallTotal = 0;
+    for (uint64_t s : stalls) stallTotal += s;
+
+    std::fprintf(out, "\n==== Guest profile (%s) ====\n",
+                 exact() ? "exact" : "sampling");
+    if (exact()) {
+        std::fprintf(out, "Cycles: %llu  Stall cycles: %llu (%.1f%%)\n", (unsigned long long)totalCycles,
+                     (unsigned long long)stallTotal, percent(stallTotal, totalCycles));
+    } else {
+        std::fprintf(out, "Samples: %llu, one per ~%d cycles  Estimated cycles: %llu  Stall cycles: %llu (%.1f%%)\n",
+                     (unsigned long long)samples, samplePeriod, (unsigned long long)totalCycles,
+                     (unsigned long long)stallTotal, percent(stallTotal, totalCycles));
+    }
+
+    // Hot instructions. "Waited on" counts dependency stalls of later instructions on this result.
+    std::vector<uint32_t> order;
+    for (uint32_t i = 0; i < cycles.size(); i++) {
+        if (cycles[i] > 0 || caused[i] > 0 || executions[i] > 0) order.push_back(i);
+    }
+    std::stable_sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return cycles[a] > cycles[b]; });
+
+    std::fprintf(out, "\nHot instructions:\n");
+    std::fprintf(out, "  %-10s  %-20s  %-10s  %12s  %12s  %6s  %12s  %12s\n",
+                 "PC", "Location", "Instr", "Executions", "Cycles", "%", "Stalls", "Waited on");
+    for (size_t n = 0; n < order.size() && static_cast<int>(n) < top; n++) {
+        uint32_t i = order[n];
+        uint32_t pc = textStart + i * 4;
+        uint32_t instruction;
+        std::memcpy(&instruction, code + pc, sizeof(instruction));
+        DecodedInstr d;
+        decode(instruction, pc, &d);
+        uint64_t stalled = 0;
+        for (int r = 0; r < numStallReasons; r++) stalled += stalls[i * numStallReasons + r];
+
+        char executed[24] = "-";
+        if (exact()) std::snprintf(executed, sizeof(executed), "%llu", (unsigned long long)executions[i]);
+        std::fprintf(out, "  0x%08X  %-20s  %-10s  %12s  %12llu  %5.1f%%  %12llu  %12llu\n", pc,
+                     location(pc).c_str(), instr_name(&d), executed, (unsigned long long)cycles[i],
+                     percent(cycles[i], totalCycles), (unsigned long long)stalled, (unsigned long long)caused[i]);
+    }
+
+    // Basic blocks, with their stall cycles split by reason
+    std::vector<size_t> blockOrder(blocks.size());
+    std::vector<uint64_t> blockCycles(blocks.size(), 0);
+    for (size_t b = 0; b < blocks.size(); b++) {
+        blockOrder[b] = b;
+        for (uint32_t pc = blocks[b].start; pc < blocks[b].end; pc += 4) blockCycles[b] += cycles[index(pc)];
+    }
+    std::stable_sort(blockOrder.begin(), blockOrder.end(),
+                     [&blockCycles](size_t a, size_t b) { return blockCycles[a] > blockCycles[b]; });
+
+    std::fprintf(out, "\nHot basic blocks:\n");
+    std::fprintf(out, "  %-20s  %-23s  %12s  %12s  %6s  %s\n", "Block", "Range", "Executions", "Cycles", "%",
+                 "Stall cycles");
+    for (size_t n = 0; n < blockOrder.size() && static_cast<int>(n) < top; n++) {
+        const Block& block = blocks[blockOrder[n]];
+        if (blockCycles[blockOrder[n]] == 0) break;
+        char range[32];
+        std::snprintf(range, sizeof(range), "0x%08X-0x%08X", block.start, block.end - 4);
+        char executed[24] = "-";
+        if (exact()) {
+            std::snprintf(executed, sizeof(executed), "%llu", (unsigned long long)executions[index(block.start)]);
+        }
+        std::fprintf(out, "  %-20s  %-23s  %12s  %12llu  %5.1f%% ", location(block.start).c_str(), range, executed,
+                     (unsigned long long)blockCycles[blockOrder[n]], percent(blockCycles[blockOrder[n]], totalCycles));
+        const char* separator = " ";
+        for (int r = 0; r < numStallReasons; r++) {
+            uint64_t reasonCycles = 0;
+            for (uint32_t pc = block.start; pc < block.end; pc += 4) {
+                reasonCycles += stalls[index(pc) * numStallReasons + r];
+            }
+            if (reasonCycles > 0) {
+                std::fprintf(out, "%s%s %llu", separator, stallNames[r], (unsigned long long)reasonCycles);
+                separator = ", ";
+            }
+        }
+        std::fprintf(out, "\n");
+    }
+
+    // Functions by self cycles
+    std::vector<uint64_t> self(functionNames.size(), 0);
+    for (size_t i = 0; i < cycles.size(); i++) self[functionAt[i]] += cycles[i];
+    std::vector<size_t> functionOrder;
+    for (size_t f = 0; f < self.size(); f++) {
+        if (self[f] > 0) functionOrder.push_back(f);
+    }
+    std::stable_sort(functionOrder.begin(), functionOrder.end(),
+                     [&self](size_t a, size_t b) { return self[a] > self[b]; });
+    std::fprintf(out, "\nFunctions (self cycles):\n");
+    for (size_t f : functionOrder) {
+        std::fprintf(out, "  %-20s  %12llu  %5.1f%%\n", functionNames[f].c_str(), (unsigned long long)self[f],
+                     percent(self[f], totalCycles));
+    }
+}
+
+void Profiler::foldNode(const CallNode* node, std::string& stack, FILE* out) const {
+    size_t length = stack.size();
+    if (node->function >= 0) {
+        if (!stack.empty()) stack += ';';
+        stack += functionNames[node->function];
+        if (node->cycles > 0) {
+            std::fprintf(out, "%s %llu\n", stack.c_str(), (unsigned long long)node->cycles);
+        }
+    }
+    for (const CallNode* child : node->children) {
+        foldNode(child, stack, out);
+    }
+    stack.resize(length);
+}
+
+// Folded stacks as read by flamegraph.pl / speedscope / inferno
+bool Profiler::writeFolded(const std::string& path) const {
+    FILE* out = std::fopen(path.c_str(), "w");
+    if (out == nullptr) {
+        std::perror("Failed to open folded stack file");
+        return false;
+    }
+    std::string stack;
+    if (!nodes.empty()) {
+        foldNode(&nodes.front(), stack, out);
+    }
+    std::fclose(out);
+    return true;
+}
@@ -0,0 +1,117 @@
+// profiler.h
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Guest profiler: charges every simulated cycle (exact mode) or every Nth cycle (sampling mode)
+// to the instruction that issued or held up issue in that cycle, and keeps a shadow call stack
+// from jal / jalr so the cycles can be folded into stacks for flamegraph tools.
+class Profiler {
+public:
+    static const int DEFAULT_SAMPLE_PERIOD = 997;   // Prime, so it does not lock onto loop periods
+    static const int NO_STALL = -1;
+    static const uint32_t NO_PC = 0xFFFFFFFFu;
+
+    // code points at guest memory; samplePeriod 0 selects exact mode.
+    // stallNames labels the stall reasons passed to cycle().
+    Profiler(const uint8_t* code, uint32_t textStart, uint32_t textEnd, int samplePeriod,
+             const char* const* stallNames, int numStallReasons);
+
+    // Symbols: labels starting with ".L" name basic blocks, everything else names a function
+    void addSymbol(const std::string& name, uint32_t address);
+    void addSymbols(const std::unordered_map<std::string, uint32_t>& symbols);
+    // Read the symbol table of a 32-bit little-endian ELF file; false if it cannot be used
+    bool loadElfSymbols(const std::string& path);
+
+    // Build the basic block and function maps; call once symbols are in, before the run
+    void start(uint32_t entry);
+
+    bool exact() const { return samplePeriod == 0; }
+
+    // An instruction issued (exact mode counts executions)
+    void retire(uint32_t pc) {
+        if (exact() && inText(pc)) executions[index(pc)]++;
+    }
+
+    // A jal / jalr was taken: link register writes are calls, jumps through ra are returns
+    void jump(uint32_t pc, uint32_t target, uint32_t rd, uint32_t rs1, bool indirect);
+
+    // One cycle went by, charged to pc; stallReason is NO_STALL when pc issued, and blamePc is
+    // the producer being waited on for dependency stalls
+    void cycle(uint32_t pc, int stallReason, uint32_t blamePc) {
+        if (--countdown == 0) {
+            sample(pc, stallReason, blamePc);
+        }
+    }
+
+    // Sorted hot-spot report (instructions, basic blocks, functions)
+    void printReport(FILE* out, int top = 20) const;
+    // One "caller;callee;leaf count" line per calling context
+    bool writeFolded(const std::string& path) const;
+
+private:
+    // Calling-context tree node
+    struct CallNode {
+        int function;
+        CallNode* parent;
+        std::vector<CallNode*> children;
+        uint64_t cycles;
+    };
+
+    struct Symbol {
+        std::string name;
+        uint32_t address;
+        bool function;
+    };
+
+    struct Block {
+        uint32_t start;
+        uint32_t end;       // Exclusive
+    };
+
+    const uint8_t* code;
+    uint32_t textStart;
+    uint32_t textEnd;
+    int samplePeriod;
+    int countdown;
+    int interval;                       // Cycles between the previous sample and the next one
+    uint32_t rng = 0x9E3779B9u;
+    const char* const* stallNames;
+    int numStallReasons;
+
+    std::vector<Symbol> symbols;
+    std::vector<std::string> functionNames;
+    std::vector<int> functionAt;        // Per instruction word
+    std::vector<int> labelAt;           // Per instruction word: nearest preceding symbol, -1 if none
+    std::vector<Block> blocks;
+
+    // Per instruction word
+    std::vector<uint64_t> executions;
+    std::vector<uint64_t> cycles;
+    std::vector<uint64_t> stalls;       // numStallReasons per word
+    std::vector<uint64_t> caused;       // Dependency stall cycles spent waiting on this result
+    uint64_t totalCycles = 0;
+    uint64_t samples = 0;
+
+    std::deque<CallNode> nodes;         // Stable addresses
+    std::vector<CallNode*> callStack;
+    CallNode* leafCache = nullptr;      // Node charged for the last sample and its function
+    int leafCacheFunction = -1;
+
+    bool inText(uint32_t pc) const { return pc >= textStart && pc < textEnd; }
+    uint32_t index(uint32_t pc) const { return (pc - textStart) >> 2; }
+
+    void sample(uint32_t pc, int stallReason, uint32_t blamePc);
+    CallNode* child(CallNode* parent, int function);
+    CallNode* leafFor(uint32_t pc);
+    std::string location(uint32_t pc) const;
+    void foldNode(const CallNode* node, std::string& stack, FILE* out) const;
+};
+
+#endif // PROFILER_H
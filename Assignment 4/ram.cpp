@@ -2,6 +2,7 @@
 #include "ram.h"
 #include <cstdlib>    // for rand()
 #include <cstring>    // for std::memcpy
+#include <stdexcept>  // for std::out_of_range
 
 // Constructor: Initializes RAM and sets up specific memory regions
 RAM::RAM() {
@@ -9,24 +10,191 @@ RAM::RAM() {
     initializeMemoryRegions();          // Initialize arrays with random FP32 values
 }
 
-// Read a 32-bit word from RAM with simulated latency
-uint32_t RAM::read(uint32_t address, int& tickCounter) {
-    if (address + 4 > RAM_SIZE) {
+// Read a 32-bit word (or a 1/2 byte value) from RAM with simulated latency
+uint32_t RAM::read(uint32_t address, uint64_t& tickCounter, uint32_t size) {
+    if (address + size > RAM_SIZE) {
         throw std::out_of_range("RAM read out of bounds.");
     }
     tickCounter += READ_LATENCY;  // Simulate read latency
-    uint32_t value;
-    std::memcpy(&value, &memory[address], sizeof(value));
-    return value;
+    return load(address, size);
 }
 
-// Write a 32-bit word to RAM with simulated latency
-void RAM::write(uint32_t address, uint32_t value, int& tickCounter) {
-    if (address + 4 > RAM_SIZE) {
+// Write a 32-bit word (or a 1/2 byte value) to RAM with simulated latency
+void RAM::write(uint32_t address, uint32_t value, uint64_t& tickCounter, uint32_t size) {
+    if (address + size > RAM_SIZE) {
         throw std::out_of_range("RAM write out of bounds.");
     }
     tickCounter += WRITE_LATENCY;  // Simulate write latency
-    std::memcpy(&memory[address], &value, sizeof(value));
+    store(address, value, size);
+}
+
+// Write the masked bytes of a line; one access regardless of how many bytes are set
+void RAM::writeLine(uint32_t lineAddress, const uint8_t* data, uint32_t byteMask, uint64_t& tickCounter) {
+    if (lineAddress % LINE_SIZE != 0 || lineAddress + LINE_SIZE > RAM_SIZE) {
+        throw std::out_of_range("RAM line write out of bounds.");
+    }
+    tickCounter += WRITE_LATENCY;  // Simulate write latency
+    uint32_t line = lineAddress / LINE_SIZE;
+    uint32_t generation = shared ? lockLine(line) : generations[line];
+    for (uint32_t i = 0; i < LINE_SIZE; i++) {
+        if (byteMask & (1u << i)) {
+            __atomic_store_n(&memory[lineAddress + i], data[i], __ATOMIC_RELAXED);
+        }
+    }
+    if (shared) {
+        unlockLine(line, generation);
+    } else {
+        generations[line] = generation + 2;
+    }
+}
+
+// Relaxed atomic load: naturally aligned values in one access, anything else byte by byte
+uint32_t RAM::sharedLoad(uint32_t address, uint32_t size) const {
+    if (address % size == 0) {
+        switch (size) {
+            case 4: return __atomic_load_n(reinterpret_cast<const uint32_t*>(&memory[address]), __ATOMIC_RELAXED);
+            case 2: return __atomic_load_n(reinterpret_cast<const uint16_t*>(&memory[address]), __ATOMIC_RELAXED);
+            case 1: return __atomic_load_n(&memory[address], __ATOMIC_RELAXED);
+        }
+    }
+    uint32_t value = 0;
+    for (uint32_t i = 0; i < size; i++) {
+        value |= static_cast<uint32_t>(__atomic_load_n(&memory[address + i], __ATOMIC_RELAXED)) << (8 * i);
+    }
+    return value;
+}
+
+// Store under the lock of every line it touches (at most two, taken in address order)
+void RAM::sharedStore(uint32_t address, uint32_t value, uint32_t size) {
+    uint32_t first = address / LINE_SIZE;
+    uint32_t last = (address + size - 1) / LINE_SIZE;
+    uint32_t firstGeneration = lockLine(first);
+    uint32_t lastGeneration = last != first ? lockLine(last) : 0;
+    if (address % size == 0 && size == 4) {
+        __atomic_store_n(reinterpret_cast<uint32_t*>(&memory[address]), value, __ATOMIC_RELAXED);
+    } else if (address % size == 0 && size == 2) {
+        __atomic_store_n(reinterpret_cast<uint16_t*>(&memory[address]), static_cast<uint16_t>(value),
+                         __ATOMIC_RELAXED);
+    } else {
+        for (uint32_t i = 0; i < size; i++) {
+            __atomic_store_n(&memory[address + i], static_cast<uint8_t>(value >> (8 * i)), __ATOMIC_RELAXED);
+        }
+    }
+    if (last != first) {
+        unlockLine(last, lastGeneration);
+    }
+    unlockLine(first, firstGeneration);
+}
+
+uint32_t RAM::lockLine(uint32_t line) {
+    uint32_t generation = __atomic_load_n(&generations[line], __ATOMIC_RELAXED);
+    while ((generation & 1) != 0 ||
+           !__atomic_compare_exchange_n(&generations[line], &generation, generation + 1, true, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED)) {
+        if ((generation & 1) != 0) {
+            generation = __atomic_load_n(&generations[line], __ATOMIC_RELAXED);
+        }
+    }
+    return generation;
+}
+
+void RAM::unlockLine(uint32_t line, uint32_t generation) {
+    __atomic_store_n(&generations[line], generation + 2, __ATOMIC_RELEASE);
+}
+
+// Word in RAM for an atomic access; misaligned or out of range addresses throw
+uint32_t* RAM::atomicWord(uint32_t address) {
+    if (address % 4 != 0 || address + 4 > RAM_SIZE) {
+        throw std::out_of_range("RAM atomic access misaligned or out of bounds.");
+    }
+    return reinterpret_cast<uint32_t*>(&memory[address]);
+}
+
+// Sequence-lock read: retry until the line's generation is even and the same before and after
+uint32_t RAM::readReserved(uint32_t address, uint32_t& value) {
+    uint32_t* word = atomicWord(address);
+    uint32_t line = address / LINE_SIZE;
+    if (!shared) {
+        value = *word;
+        return generations[line];
+    }
+    while (true) {
+        uint32_t generation = __atomic_load_n(&generations[line], __ATOMIC_ACQUIRE);
+        if ((generation & 1) != 0) {
+            continue;
+        }
+        value = __atomic_load_n(word, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&generations[line], __ATOMIC_RELAXED) == generation) {
+            return generation;
+        }
+    }
+}
+
+// Read a word and reserve its line, with read latency
+uint32_t RAM::loadReserved(uint32_t address, uint32_t& reservation, uint64_t& tickCounter) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    uint32_t value;
+    reservation = readReserved(address, value);
+    tickCounter += READ_LATENCY;
+    return value;
+}
+
+// Store only if the line is still at the reserved generation; read latency, plus write latency on success
+bool RAM::storeConditional(uint32_t address, uint32_t value, uint32_t reservation, uint64_t& tickCounter) {
+    uint32_t* word = atomicWord(address);
+    uint32_t line = address / LINE_SIZE;
+    tickCounter += READ_LATENCY;
+    if (!shared) {
+        if (generations[line] != reservation) {
+            return false;
+        }
+        *word = value;
+        generations[line] = reservation + 2;
+    } else {
+        uint32_t expected = reservation;
+        if (!__atomic_compare_exchange_n(&generations[line], &expected, reservation + 1, false, __ATOMIC_ACQUIRE,
+                                         __ATOMIC_RELAXED)) {
+            return false;
+        }
+        __atomic_store_n(word, value, __ATOMIC_RELAXED);
+        unlockLine(line, reservation);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+    tickCounter += WRITE_LATENCY;
+    return true;
+}
+
+// Atomic read-modify-write returning the old value; one read and one write of latency
+uint32_t RAM::atomicRmw(uint32_t address, AtomicOp op, uint32_t operand, uint64_t& tickCounter) {
+    uint32_t* word = atomicWord(address);
+    uint32_t line = address / LINE_SIZE;
+    tickCounter += READ_LATENCY + WRITE_LATENCY;
+    if (shared) {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+    uint32_t generation = shared ? lockLine(line) : generations[line];
+    uint32_t old = __atomic_load_n(word, __ATOMIC_RELAXED);
+    uint32_t result;
+    switch (op) {
+        case AMO_SWAP: result = operand; break;
+        case AMO_ADD: result = old + operand; break;
+        case AMO_XOR: result = old ^ operand; break;
+        case AMO_AND: result = old & operand; break;
+        case AMO_OR: result = old | operand; break;
+        case AMO_MIN: result = (int32_t)operand < (int32_t)old ? operand : old; break;
+        case AMO_MAX: result = (int32_t)operand > (int32_t)old ? operand : old; break;
+        case AMO_MINU: result = operand < old ? operand : old; break;
+        default: result = operand > old ? operand : old; break;
+    }
+    __atomic_store_n(word, result, __ATOMIC_RELAXED);
+    if (shared) {
+        unlockLine(line, generation);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    } else {
+        generations[line] = generation + 2;
+    }
+    return old;
 }
 
 // Print memory contents for debugging
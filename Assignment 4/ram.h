@@ -3,30 +3,94 @@
 #define RAM_H
 
 #include <cstdint>
+#include <cstring>
 #include <iostream>
 
 class RAM {
 public:
-    static const uint32_t RAM_SIZE = 0x13FF;  // Size of RAM
+    static const uint32_t RAM_SIZE = 0x1400;  // Size of RAM (0x0000 - 0x13FF)
     static const int READ_LATENCY = 20;       // RAM read latency in simulation ticks
     static const int WRITE_LATENCY = 20;      // RAM write latency in simulation ticks
+    static const uint32_t LINE_SIZE = 16;     // Bytes moved by one line write
+
+    // Read-modify-write operations of the RV32A amo*.w instructions
+    enum AtomicOp { AMO_SWAP, AMO_ADD, AMO_XOR, AMO_AND, AMO_OR, AMO_MIN, AMO_MAX, AMO_MINU, AMO_MAXU };
 
     RAM();
 
-    // Read a 32-bit word from RAM with simulated latency
-    uint32_t read(uint32_t address, int& tickCounter);
+    // Harts on several host threads use this RAM: from now on every access is an atomic one and
+    // stores take their line's lock. Set before the threads start.
+    void setShared(bool shared) { this->shared = shared; }
+
+    // Untimed access for the instruction port and the functional interpreter; the caller checks
+    // the range
+    uint32_t load(uint32_t address, uint32_t size = 4) const {
+        if (shared) return sharedLoad(address, size);
+        uint32_t value = 0;
+        std::memcpy(&value, &memory[address], size);
+        return value;
+    }
+    void store(uint32_t address, uint32_t value, uint32_t size = 4) {
+        if (shared) {
+            sharedStore(address, value, size);
+            return;
+        }
+        std::memcpy(&memory[address], &value, size);
+        generations[address / LINE_SIZE] += 2;
+        generations[(address + size - 1) / LINE_SIZE] += 2;
+    }
+
+    // Read a 32-bit word (or a 1/2 byte value) from RAM with simulated latency
+    uint32_t read(uint32_t address, uint64_t& tickCounter, uint32_t size = 4);
+
+    // Write a 32-bit word (or a 1/2 byte value) to RAM with simulated latency
+    void write(uint32_t address, uint32_t value, uint64_t& tickCounter, uint32_t size = 4);
+
+    // Write the bytes of one line selected by byteMask in a single access
+    void writeLine(uint32_t lineAddress, const uint8_t* data, uint32_t byteMask, uint64_t& tickCounter);
+
+    // Atomic word accesses, safe against cores running on other host threads. The address must be
+    // word aligned. Each pays the latency of the RAM accesses it makes. The reservation set of
+    // lr.w / sc.w is the word's line: every store to the line bumps its generation, and sc.w
+    // only succeeds if the generation lr.w saw is still current.
 
-    // Write a 32-bit word to RAM with simulated latency
-    void write(uint32_t address, uint32_t value, int& tickCounter);
+    // Read a word and the reservation for its line (lr.w)
+    uint32_t loadReserved(uint32_t address, uint32_t& reservation, uint64_t& tickCounter);
+
+    // Store value if no store reached the line since reservation was taken (sc.w); the write is
+    // only paid on success
+    bool storeConditional(uint32_t address, uint32_t value, uint32_t reservation, uint64_t& tickCounter);
+
+    // Apply op with operand to the word and return its old value (amo*.w)
+    uint32_t atomicRmw(uint32_t address, AtomicOp op, uint32_t operand, uint64_t& tickCounter);
 
     // Print memory contents for debugging
     void print(uint32_t start, uint32_t end) const;
 
+    // Backing store for program loading before the harts start (no latency)
+    uint8_t* raw() { return memory; }
+    const uint8_t* raw() const { return memory; }
+
 private:
-    uint8_t memory[RAM_SIZE];  // RAM storage array
+    static const uint32_t NUM_LINES = RAM_SIZE / LINE_SIZE;
+
+    alignas(4) uint8_t memory[RAM_SIZE];  // RAM storage array (aligned for the atomic word accesses)
+    uint32_t generations[NUM_LINES] = {}; // Per line: +2 for every store, odd while a store holds the line
+    bool shared = false;
+
+    uint32_t sharedLoad(uint32_t address, uint32_t size) const;
+    void sharedStore(uint32_t address, uint32_t value, uint32_t size);
+    // Take the line for a store (waits while another store holds it); returns its even generation
+    uint32_t lockLine(uint32_t line);
+    void unlockLine(uint32_t line, uint32_t generation);
 
     // Initialize specific memory regions as per specifications
     void initializeMemoryRegions();
+
+    // Aligned, in-range word for an atomic access
+    uint32_t* atomicWord(uint32_t address);
+    // Generation of the line holding address once no store holds it, with the word read under it
+    uint32_t readReserved(uint32_t address, uint32_t& value);
 };
 
 #endif // RAM_H
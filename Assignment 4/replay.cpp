@@ -0,0 +1,127 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mem_trace.h"
+#include "store_buffer.h"
+
+// Trace-driven memory hierarchy sweeps: replays a trace captured with simulator -t through
+// store buffer / prefetcher configurations without running the core, one configuration per
+// worker thread at a time
+
+// Swept when no -c is given
+const int sweep_depths[] = {0, 2, 4, 8, 16};
+const char *sweep_prefetchers[] = {"none", "next", "stride", "stream"};
+
+void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [-j threads] [-c depth[:prefetcher[:degree[:distance]]]]... <trace.bin>\n", program);
+    fprintf(stderr, "  -j  worker threads (default: one per host CPU)\n");
+    fprintf(stderr, "  -c  replay this configuration, e.g. 4:stride:2:4; may be repeated. Without -c every\n"
+                    "      store buffer depth of 0 2 4 8 16 is swept with no, next-line, stride and stream\n"
+                    "      prefetching\n");
+}
+
+// Parse depth[:prefetcher[:degree[:distance]]]
+bool parse_config(const char *text, ReplayConfig &config) {
+    char kind[16] = "none";
+    config.prefetch = PrefetchConfig();
+    int fields = sscanf(text, "%d:%15[^:]:%d:%d", &config.storeBufferDepth, kind, &config.prefetch.degree,
+                        &config.prefetch.distance);
+    config.prefetcher = kind;
+    bool known = false;
+    for (const char *prefetcher : sweep_prefetchers) {
+        known = known || config.prefetcher == prefetcher;
+    }
+    return fields >= 1 && known && config.storeBufferDepth >= 0 &&
+           config.storeBufferDepth <= StoreBuffer::MAX_DEPTH && config.prefetch.degree >= 1 &&
+           config.prefetch.distance >= 1;
+}
+
+int main(int argc, char *argv[]) {
+    const char *trace_path = NULL;
+    int threads = (int)std::thread::hardware_concurrency();
+    std::vector<ReplayConfig> configs;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            ReplayConfig config;
+            if (!parse_config(argv[++i], config)) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            configs.push_back(config);
+        } else if (argv[i][0] != '-' && trace_path == NULL) {
+            trace_path = argv[i];
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (trace_path == NULL) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (configs.empty()) {
+        for (int depth : sweep_depths) {
+            for (const char *prefetcher : sweep_prefetchers) {
+                configs.push_back({depth, prefetcher, PrefetchConfig()});
+            }
+        }
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (threads > (int)configs.size()) {
+        threads = (int)configs.size();
+    }
+
+    std::vector<TraceRecord> records;
+    auto load_start = std::chrono::steady_clock::now();
+    if (!readTrace(trace_path, records)) {
+        return EXIT_FAILURE;
+    }
+    double load_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - load_start).count();
+    printf("Trace %s: %zu accesses (%.2f ms to load)\n", trace_path, records.size(), 1000.0 * load_seconds);
+
+    // Workers take the next configuration until none are left; the records are shared read-only
+    std::vector<ReplayResult> results(configs.size());
+    std::vector<char> ok(configs.size(), 0);
+    std::atomic<size_t> next(0);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&] {
+            for (size_t i = next++; i < configs.size(); i = next++) {
+                ok[i] = replayTrace(records, configs[i], results[i]);
+            }
+        });
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printReplayHeader(stdout);
+    for (size_t i = 0; i < configs.size(); i++) {
+        if (ok[i]) {
+            printReplayRow(stdout, configs[i], results[i]);
+        }
+    }
+    double accesses = (double)records.size() * configs.size();
+    printf("Replayed %zu configurations on %d threads in %.2f ms (%.1f M accesses/s)\n", configs.size(), threads,
+           1000.0 * seconds, seconds > 0 ? accesses / seconds / 1e6 : 0.0);
+    for (size_t i = 0; i < configs.size(); i++) {
+        if (!ok[i]) {
+            return EXIT_FAILURE;
+        }
+    }
+    return 0;
+}
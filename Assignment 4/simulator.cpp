@@ -2,33 +2,71 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include <time.h>
 
-#define RAM_SIZE 0xC00
-#define NUM_REGISTERS 32
-#define CPU_CYCLE_TICKS 10
-#define RAM_LATENCY_TICKS 20
-#define RV32I_LATENCY_TICKS 10
-#define RV32F_LATENCY_TICKS 50
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
-// Integer and Floating Point Register Banks
-uint32_t int_regs[NUM_REGISTERS];
-float fp_regs[NUM_REGISTERS];
+#include "assembler.h"
+#include "core.h"
+#include "host_profile.h"
+#include "interpreter.h"
+#include "machine.h"
+#include "mem_trace.h"
+#include "ram.h"
+#include "store_buffer.h"
+#include "prefetcher.h"
+#include "profiler.h"
 
-// Program Counter
-uint32_t pc = 0;
+#define RAM_SIZE RAM::RAM_SIZE
 
-// RAM (byte-addressable)
-uint8_t ram[RAM_SIZE];
+#define PROGRAM_END 0x094       // End of the instructions loaded from vadd.c
+#define STACK_TOP 0x300         // Stack lives in 0x200 - 0x2FF
 
-// Simulation tick counter
-uint32_t sim_ticks = 0;
+#define DEFAULT_ISSUE_WIDTH 2   // Dual issue unless told otherwise
 
-// Pipeline stage variables
-uint32_t fetched_instruction;
-uint32_t decoded_instruction;
-bool mem_access = false;
-uint32_t execute_result;
+#define MAX_HARTS 8             // Each hart gets an equal slice of the stack region
+#define HART_QUANTUM 100        // Cycles harts may drift apart before waiting for each other
+
+uint32_t program_start = 0;
+uint32_t program_end = PROGRAM_END;
+std::unordered_map<std::string, uint32_t> program_symbols;     // Labels of an assembled program
+
+// RAM (byte-addressable) and the store buffer on its data port
+RAM ram;
+int store_buffer_depth = StoreBuffer::DEFAULT_DEPTH;
+
+// Data prefetcher below the store buffer ("none" leaves loads going straight to RAM)
+std::string prefetch_kind = "none";
+PrefetchConfig prefetch_config;
+bool demand_fill = false;   // Prefetch buffer also keeps the lines of demand misses (with -p none too)
+
+// Core configuration requested on the command line; matched against the pre-instantiated ones
+int issue_width = DEFAULT_ISSUE_WIDTH;
+bool trace = true;
+bool fp_unit = true;
+bool counters = true;
+bool fusion = false;
+bool functional = false;    // Fast interpreter, no timing
+int num_harts = 1;          // Cores running the program, each on its own host thread
+
+// Guest profiler: off, exact (every cycle) or sampling (every ~N cycles)
+bool profile = false;
+int profile_period = 0;
+const char *folded_path = NULL;
+const char *elf_path = NULL;
+
+// Data port accesses are captured to this file for replay when set
+const char *capture_path = NULL;
+
+// Self-profile of the simulator: host time per phase and host hardware counters
+bool host_profile = false;
 
 // Initialize RAM with given memory map specifications by reading from the binary file
 void init_ram(const char *filename) {
@@ -39,7 +77,7 @@ void init_ram(const char *filename) {
     }
 
     // Read binary instructions into RAM
-    size_t read_size = fread(ram, 1, RAM_SIZE, file);
+    size_t read_size = fread(ram.raw(), 1, RAM_SIZE, file);
     if (read_size != RAM_SIZE) {
         printf("Warning: Read %zu bytes, expected %d bytes\n", read_size, RAM_SIZE);
     }
@@ -48,85 +86,385 @@ void init_ram(const char *filename) {
     printf("RAM initialized with instructions from %s.\n", filename);
 }
 
-// Fetch stage
-void fetch() {
-    if (pc < RAM_SIZE - 4) {
-        fetched_instruction = *(uint32_t*)&ram[pc];
-        pc += 4;
-        printf("Fetched instruction: 0x%08X at PC: 0x%08X\n", fetched_instruction, pc);
+// Initialize RAM by assembling an RV32IF source file in place, starting at address 0
+void assemble_ram(const char *filename) {
+    clock_t start = clock();
+    Assembler assembler(ram.raw(), RAM_SIZE);
+    if (!assembler.assembleFile(filename, 0)) {
+        exit(EXIT_FAILURE);
     }
+    program_start = assembler.textStart();
+    program_end = assembler.textEnd();
+    program_symbols = assembler.symbols();
+    printf("RAM initialized from %s: code 0x%08X - 0x%08X, data 0x%08X - 0x%08X (%.2f ms)\n", filename,
+           assembler.textStart(), assembler.textEnd(), assembler.dataStart(), assembler.dataEnd(),
+           1000.0 * (clock() - start) / CLOCKS_PER_SEC);
 }
 
-// Decode stage: Decode the opcode from the fetched instruction
-void decode() {
-    decoded_instruction = fetched_instruction; // Simple decode for now
-    printf("Decoded instruction: 0x%08X\n", decoded_instruction);
+bool is_assembly(const char *filename) {
+    size_t length = strlen(filename);
+    return length > 2 && filename[length - 2] == '.' && (filename[length - 1] == 's' || filename[length - 1] == 'S');
 }
 
-// Execute stage: Perform specific operations based on the opcode
-void execute() {
-    uint32_t opcode = decoded_instruction & 0x7F; // Get last 7 bits for opcode
+// Write the accesses captured from all harts as one trace
+void write_capture(const std::vector<TraceCapture *> &captures) {
+    std::vector<TraceRecord> records;
+    for (TraceCapture *capture : captures) {
+        records.insert(records.end(), capture->records.begin(), capture->records.end());
+    }
+    if (writeTrace(capture_path, records)) {
+        printf("Memory trace of %zu accesses written to %s\n", records.size(), capture_path);
+    }
+}
+
+// Top of the stack slice of hart
+uint32_t hart_stack_top(int hart) {
+    return STACK_TOP - hart * (0x100 / num_harts);
+}
+
+// Functional multi-core run: one interpreter per hart on its own thread, all on the same RAM
+void run_interpreters() {
+    std::vector<std::unique_ptr<Interpreter>> harts;
+    for (int hart = 0; hart < num_harts; hart++) {
+        Interpreter *interpreter = new Interpreter(ram, program_start, program_end);
+        interpreter->intRegs[1] = program_end;              // ra
+        interpreter->intRegs[2] = hart_stack_top(hart);     // sp
+        interpreter->intRegs[10] = hart;                    // a0
+        interpreter->intRegs[11] = num_harts;               // a1
+        harts.emplace_back(interpreter);
+    }
+    ram.setShared(true);
+    std::vector<std::thread> threads;
+    for (auto &interpreter : harts) {
+        threads.emplace_back([&interpreter] { interpreter->run(program_start); });
+    }
+    for (int hart = 0; hart < num_harts; hart++) {
+        threads[hart].join();
+        printf("\n==== Hart %d ====\n", hart);
+        harts[hart]->printStatistics();
+    }
+}
 
-    switch (opcode) {
-        case 0x33: // Example for ADD
-            int_regs[1] = int_regs[2] + int_regs[3]; // Modify based on your instruction format
-            sim_ticks += RV32I_LATENCY_TICKS;
-            printf("Executed ADD instruction: Result = %u\n", int_regs[1]);
-            break;
+// Barrier that keeps hart threads within one quantum of simulated time of each other: every
+// running hart simulates a quantum, then waits until the others have too. Finished harts drop out.
+class QuantumBarrier {
+public:
+    explicit QuantumBarrier(int harts) : running(harts) {}
 
-        case 0x53: // Example for FADD.S
-            fp_regs[1] = fp_regs[2] + fp_regs[3]; // Modify based on your instruction format
-            sim_ticks += RV32F_LATENCY_TICKS;
-            printf("Executed FADD.S instruction: Result = %f\n", fp_regs[1]);
-            break;
+    // End of a quantum; done harts leave without waiting
+    void arrive(bool done) {
+        std::unique_lock<std::mutex> guard(lock);
+        if (done) {
+            running--;
+        } else {
+            waiting++;
+        }
+        if (waiting == running) {
+            waiting = 0;
+            generation++;
+            wake.notify_all();
+        } else if (!done) {
+            uint64_t current = generation;
+            wake.wait(guard, [&] { return generation != current; });
+        }
+    }
 
-        case 0x03: // Example for LOAD
-            mem_access = true;
-            printf("Load instruction decoded. Preparing memory access.\n");
-            break;
+private:
+    std::mutex lock;
+    std::condition_variable wake;
+    int running;
+    int waiting = 0;
+    uint64_t generation = 0;
+};
 
-        default:
-            printf("Unknown or unimplemented instruction opcode: 0x%02X\n", opcode);
-            break;
+// Timing multi-core run: one core per hart on its own thread, each with its own store buffer
+// and prefetcher in front of the shared RAM. The harts advance in quanta of HART_QUANTUM cycles
+// and each publishes its store buffer at the end of a quantum, so a store becomes visible to the
+// others within a quantum of when it happened (sooner once its entry closes); there is no
+// contention model between them beyond the latency each atomic pays on its own data port.
+int run_cores(const MachineOptions &options) {
+    std::vector<std::unique_ptr<StoreBuffer>> buffers;
+    std::vector<std::unique_ptr<PrefetchUnit>> units;
+    std::vector<std::unique_ptr<Machine>> machines;
+    std::vector<std::unique_ptr<TraceCapture>> captures;
+    for (int hart = 0; hart < num_harts; hart++) {
+        StoreBuffer *buffer = new StoreBuffer(ram, store_buffer_depth);
+        buffers.emplace_back(buffer);
+        PrefetchUnit *unit = NULL;
+        if (prefetch_kind != "none" || demand_fill) {
+            Prefetcher *prefetcher = PrefetchUnit::create(prefetch_kind, prefetch_config);
+            if (prefetcher == NULL || prefetch_config.degree < 1 || prefetch_config.distance < 1) {
+                fprintf(stderr, "Unknown prefetcher '%s' or bad degree / distance\n", prefetch_kind.c_str());
+                return EXIT_FAILURE;
+            }
+            unit = new PrefetchUnit(ram, prefetcher, demand_fill);
+            units.emplace_back(unit);
+            buffer->attachPrefetcher(unit);
+        }
+        CoreSetup setup = { &ram, buffer, unit, NULL, program_end, hart_stack_top(hart), {},
+                            (uint32_t)hart, (uint32_t)num_harts };
+        machines.emplace_back(new Machine(setup, options));
+        if (capture_path != NULL) {
+            captures.emplace_back(new TraceCapture(hart));
+            machines.back()->attach(captures.back().get());
+        }
     }
-}
 
-// Memory stage: Handle memory accesses if required
-void memory() {
-    if (mem_access) {
-        sim_ticks += RAM_LATENCY_TICKS;
-        printf("Memory access complete with latency.\n");
-        mem_access = false;
+    ram.setShared(true);
+    QuantumBarrier barrier(num_harts);
+    std::vector<std::thread> threads;
+    for (int hart = 0; hart < num_harts; hart++) {
+        Machine *machine = machines[hart].get();
+        StoreBuffer *buffer = buffers[hart].get();
+        threads.emplace_back([machine, buffer, &barrier] {
+            bool done = false;
+            while (!done) {
+                done = machine->step(HART_QUANTUM) < HART_QUANTUM || machine->done();
+                buffer->publish(machine->state()->ticks());
+                barrier.arrive(done);
+            }
+        });
+    }
+    uint64_t longest = 0;
+    for (int hart = 0; hart < num_harts; hart++) {
+        threads[hart].join();
+        printf("\n==== Hart %d ====", hart);
+        machines[hart]->finish();
+        uint64_t cycles = machines[hart]->state()->total_cycles();
+        if (cycles > longest) longest = cycles;
     }
+    printf("\n%d harts done after %llu cycles (the slowest hart)\n", num_harts, (unsigned long long)longest);
+    if (capture_path != NULL) {
+        std::vector<TraceCapture *> all;
+        for (auto &capture : captures) {
+            all.push_back(capture.get());
+        }
+        write_capture(all);
+    }
+    return 0;
 }
 
-// Write-back stage: Write results to registers (simulated)
-void write_back() {
-    printf("Write-back stage complete.\n");
+void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [-w issue_width] [-s store_buffer_depth] [-p prefetcher[:degree[:distance]]]"
+                    " [-L] [-c harts] [-q] [-n] [-i] [-u] [-f] [-t trace.bin] [-P exact|sample[:N]] [-F folded.txt]"
+                    " [-y symbols.elf] [-H] <program.bin|program.s>\n", program);
+    fprintf(stderr, "  -w  instructions issued per cycle, 1-%d (default %d)\n", MAX_ISSUE_WIDTH, DEFAULT_ISSUE_WIDTH);
+    fprintf(stderr, "  -s  store buffer entries, 0-%d; 0 makes every store wait for RAM (default %d)\n",
+            StoreBuffer::MAX_DEPTH, StoreBuffer::DEFAULT_DEPTH);
+    fprintf(stderr, "  -p  data prefetcher: none, next, stride or stream (default none),\n"
+                    "      optionally with degree and distance, e.g. stride:2:4\n");
+    fprintf(stderr, "  -L  keep the lines of demand misses in the prefetch buffer too (a %d-line load cache);\n"
+                    "      also applies to -p none, the baseline to compare prefetchers with it against\n",
+            PrefetchUnit::DEFAULT_ENTRIES);
+    fprintf(stderr, "  -c  run the program on 1-%d cores sharing RAM, each on a host thread; a0 holds the\n"
+                    "      hart id and a1 the number of harts (implies -q)\n", MAX_HARTS);
+    fprintf(stderr, "  -q  quiet: no per-cycle trace\n");
+    fprintf(stderr, "  -n  no statistics counters, report cycles and CPI only\n");
+    fprintf(stderr, "  -i  integer-only core without the FP unit\n");
+    fprintf(stderr, "  -u  macro-op fusion: issue lui+load, lui+addi, slli+add and addi+branch pairs in one slot\n");
+    fprintf(stderr, "  -f  functional run on the fast interpreter (always fuses), no timing\n");
+    fprintf(stderr, "  -t  capture every data port access to a memory trace for the replay tool\n");
+    fprintf(stderr, "  -P  profile the guest: every cycle, or one sample per ~N cycles (default %d)\n",
+            Profiler::DEFAULT_SAMPLE_PERIOD);
+    fprintf(stderr, "  -F  write the profile as folded stacks for flamegraph tools\n");
+    fprintf(stderr, "  -y  take profiler symbols from an ELF file (for .bin programs)\n");
+    fprintf(stderr, "  -H  report the host time the core spends per phase and the host hardware counters;\n"
+                    "      the phases are timed in cores built with hooks, as for the trace\n");
+    fprintf(stderr, "  -s 0 together with -p none (without -L) runs a core without caches on the data port\n");
+    print_core_presets(stderr);
 }
 
-// Simulate the CPU pipeline
-void simulate_pipeline() {
-    while (pc < 0x094) { // Run until the end of loaded instructions
-        write_back();
-        memory();
-        execute();
-        decode();
-        fetch();
+int main(int argc, char *argv[]) {
+    const char *program = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            issue_width = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            store_buffer_depth = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            char kind[16] = "";
+            int degree = prefetch_config.degree;
+            int distance = prefetch_config.distance;
+            if (sscanf(argv[++i], "%15[^:]:%d:%d", kind, &degree, &distance) < 1) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            prefetch_kind = kind;
+            prefetch_config.degree = degree;
+            prefetch_config.distance = distance;
+        } else if (strcmp(argv[i], "-L") == 0) {
+            demand_fill = true;
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            num_harts = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-q") == 0) {
+            trace = false;
+        } else if (strcmp(argv[i], "-n") == 0) {
+            counters = false;
+        } else if (strcmp(argv[i], "-i") == 0) {
+            fp_unit = false;
+        } else if (strcmp(argv[i], "-u") == 0) {
+            fusion = true;
+        } else if (strcmp(argv[i], "-f") == 0) {
+            functional = true;
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            capture_path = argv[++i];
+        } else if (strcmp(argv[i], "-P") == 0 && i + 1 < argc) {
+            const char *mode = argv[++i];
+            profile = true;
+            if (strcmp(mode, "exact") == 0) {
+                profile_period = 0;
+            } else if (strcmp(mode, "sample") == 0) {
+                profile_period = Profiler::DEFAULT_SAMPLE_PERIOD;
+            } else if (sscanf(mode, "sample:%d", &profile_period) != 1 || profile_period < 1) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "-F") == 0 && i + 1 < argc) {
+            folded_path = argv[++i];
+        } else if (strcmp(argv[i], "-y") == 0 && i + 1 < argc) {
+            elf_path = argv[++i];
+        } else if (strcmp(argv[i], "-H") == 0) {
+            host_profile = true;
+        } else if (argv[i][0] != '-' && program == NULL) {
+            program = argv[i];
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (program == NULL) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (issue_width < 1 || issue_width > MAX_ISSUE_WIDTH) {
+        fprintf(stderr, "Issue width must be between 1 and %d\n", MAX_ISSUE_WIDTH);
+        return EXIT_FAILURE;
+    }
+    if (store_buffer_depth < 0 || store_buffer_depth > StoreBuffer::MAX_DEPTH) {
+        fprintf(stderr, "Store buffer depth must be between 0 and %d\n", StoreBuffer::MAX_DEPTH);
+        return EXIT_FAILURE;
+    }
+    if (num_harts < 1 || num_harts > MAX_HARTS) {
+        fprintf(stderr, "Number of harts must be between 1 and %d\n", MAX_HARTS);
+        return EXIT_FAILURE;
+    }
+    if (num_harts > 1) {
+        trace = false;      // Traces of concurrent cores would interleave
+    }
 
-        // Simulate CPU cycle and ticks
-        sim_ticks += CPU_CYCLE_TICKS;
-        printf("Simulation ticks: %u\n", sim_ticks);
+    if ((folded_path != NULL || elf_path != NULL) && !profile) {
+        profile = true;     // Asking for profile output implies exact profiling
+    }
+    if (capture_path != NULL && functional) {
+        fprintf(stderr, "Memory traces come from the timing core; drop -f\n");
+        return EXIT_FAILURE;
+    }
+    if (host_profile && functional) {
+        fprintf(stderr, "Host profiling times the phases of the timing core; drop -f\n");
+        return EXIT_FAILURE;
+    }
+    if (profile && num_harts > 1) {
+        fprintf(stderr, "Profiling follows a single core; drop -c\n");
+        return EXIT_FAILURE;
+    }
+    if (profile && !counters) {
+        fprintf(stderr, "Profiling needs the statistics counters; drop -n\n");
+        return EXIT_FAILURE;
     }
-}
 
-int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <program.bin>\n", argv[0]);
+    if (functional) {
+        if (is_assembly(program)) {
+            assemble_ram(program);
+        } else {
+            init_ram(program);
+        }
+        if (num_harts > 1) {
+            run_interpreters();
+            return 0;
+        }
+        Interpreter interpreter(ram, program_start, program_end);
+        interpreter.intRegs[1] = program_end;   // ra
+        interpreter.intRegs[2] = STACK_TOP;     // sp
+        interpreter.intRegs[11] = num_harts;    // a1
+        interpreter.run(program_start);
+        interpreter.printStatistics();
+        return 0;
+    }
+
+    MachineOptions options;
+    options.issue_width = issue_width;
+    options.caches = store_buffer_depth > 0 || prefetch_kind != "none" || demand_fill;
+    options.fp_unit = fp_unit;
+    options.counters = counters;
+    options.fusion = fusion;
+    // The trace and the capture are the only observers here, so they decide whether the core is
+    // built with hooks; the host phase timers live in those builds too
+    options.hooks = host_profile;
+    bool hooks = trace || capture_path != NULL || host_profile;
+    if (find_core_preset(issue_width, hooks, options.caches, fp_unit, counters, fusion) == NULL) {
+        fprintf(stderr, "No pre-instantiated core for this combination of options\n");
+        print_core_presets(stderr);
         return EXIT_FAILURE;
     }
+    if (host_profile) {
+        // -H swaps in the preset with hooks, which a -q run would not use; say so next to the numbers
+        HostProfile::start(true, "the core preset with hooks, which -H selects even for a -q run");
+    }
+
+    if (is_assembly(program)) {
+        assemble_ram(program);
+    } else {
+        init_ram(program); // Pass the binary file name to init_ram
+    }
+    if (num_harts > 1) {
+        return run_cores(options);
+    }
+    StoreBuffer buffer(ram, store_buffer_depth);
+
+    PrefetchUnit *unit = NULL;
+    if (prefetch_kind != "none" || demand_fill) {
+        Prefetcher *prefetcher = PrefetchUnit::create(prefetch_kind, prefetch_config);
+        if (prefetcher == NULL || prefetch_config.degree < 1 || prefetch_config.distance < 1) {
+            fprintf(stderr, "Unknown prefetcher '%s' or bad degree / distance\n", prefetch_kind.c_str());
+            return EXIT_FAILURE;
+        }
+        unit = new PrefetchUnit(ram, prefetcher, demand_fill);
+        buffer.attachPrefetcher(unit);
+    }
 
-    init_ram(argv[1]); // Pass the binary file name to init_ram
-    simulate_pipeline();
+    Profiler *profiler = NULL;
+    if (profile) {
+        profiler = new Profiler(ram.raw(), program_start, program_end, profile_period,
+                                stall_names, NUM_STALL_REASONS);
+        profiler->addSymbols(program_symbols);
+        if (elf_path != NULL && !profiler->loadElfSymbols(elf_path)) {
+            return EXIT_FAILURE;
+        }
+        profiler->start(program_start);
+    }
+
+    CoreSetup setup = { &ram, &buffer, unit, profiler, program_end, STACK_TOP, {} };
+    Machine machine(setup, options);
+    TracePrinter printer;
+    if (trace) {
+        machine.attach(&printer);
+    }
+    TraceCapture capture(0);
+    if (capture_path != NULL) {
+        machine.attach(&capture);
+    }
+    machine.run();
+    if (capture_path != NULL) {
+        write_capture({&capture});
+    }
+
+    if (profiler != NULL) {
+        profiler->printReport(stdout);
+        if (folded_path != NULL && profiler->writeFolded(folded_path)) {
+            printf("Folded stacks written to %s\n", folded_path);
+        }
+        delete profiler;
+    }
+    delete unit;
     return 0;
 }
@@ -0,0 +1,187 @@
+// store_buffer.cpp
+#include "store_buffer.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+const uint32_t FULL_LINE_MASK = (1u << RAM::LINE_SIZE) - 1;
+}
+
+// Constructor: depth is clamped to the entry array
+StoreBuffer::StoreBuffer(RAM& ram, int depth)
+    : ram(ram), depth(depth < 0 ? 0 : (depth > MAX_DEPTH ? MAX_DEPTH : depth)) {}
+
+// Buffer a store; merges into an open entry for the same line
+void StoreBuffer::write(uint32_t address, uint32_t value, uint64_t& tickCounter, uint32_t size) {
+    if (depth == 0) {
+        stores++;
+        ram.write(address, value, tickCounter, size);
+        return;
+    }
+    if (address + size > RAM::RAM_SIZE) {
+        throw std::out_of_range("RAM write out of bounds.");
+    }
+
+    uint32_t lineAddress = address & ~(RAM::LINE_SIZE - 1);
+    uint32_t offset = address - lineAddress;
+    if (offset + size > RAM::LINE_SIZE) {
+        // Misaligned store straddling two lines: buffer it byte by byte
+        for (uint32_t i = 0; i < size; i++) {
+            write(address + i, value >> (8 * i), tickCounter, 1);
+        }
+        return;
+    }
+
+    stores++;
+    retire(tickCounter);
+
+    // Only the youngest entry for this line may take the bytes, otherwise stores would reorder
+    int index = count - 1;
+    while (index >= 0 && entryAt(index).lineAddress != lineAddress) index--;
+    if (index >= 0 && entryAt(index).open) {
+        coalesced++;
+    } else {
+        // The stores have moved on to a new line: complete lines have nothing left to merge,
+        // so start writing them in the background
+        for (int i = count - 1; i >= 0; i--) {
+            if (entryAt(i).open && entryAt(i).byteMask == FULL_LINE_MASK) {
+                close(i, tickCounter);
+                break;
+            }
+        }
+        if (count == depth) {
+            // Full: the oldest line has to go, stall until its write completes
+            fullStalls++;
+            close(0, tickCounter);
+            uint64_t freeTick = std::max(tickCounter, entryAt(0).doneTick);
+            stallTicks += freeTick - tickCounter;
+            tickCounter = freeTick;
+            retire(tickCounter);
+        }
+        index = count++;
+        Entry& entry = entryAt(index);
+        entry.lineAddress = lineAddress;
+        entry.byteMask = 0;
+        entry.open = true;
+    }
+
+    Entry& entry = entryAt(index);
+    entry.lastStoreTick = tickCounter;
+    for (uint32_t b = 0; b < size; b++) {
+        entry.data[offset + b] = static_cast<uint8_t>(value >> (8 * b));
+        entry.byteMask |= 1u << (offset + b);
+    }
+}
+
+// Load with store-to-load forwarding; the youngest buffered copy of each byte wins
+uint32_t StoreBuffer::read(uint32_t address, uint64_t& tickCounter, uint32_t size, uint32_t pc) {
+    if (depth == 0) {
+        return readBelow(address, tickCounter, size, pc);
+    }
+    if (address + size > RAM::RAM_SIZE) {
+        throw std::out_of_range("RAM read out of bounds.");
+    }
+    retire(tickCounter);
+
+    uint32_t value = 0;
+    uint32_t forwardedMask = 0;
+    for (uint32_t b = 0; b < size; b++) {
+        uint32_t byteAddress = address + b;
+        uint32_t lineAddress = byteAddress & ~(RAM::LINE_SIZE - 1);
+        uint32_t offset = byteAddress - lineAddress;
+        for (int i = count - 1; i >= 0; i--) {
+            const Entry& entry = entryAt(i);
+            if (entry.lineAddress == lineAddress && (entry.byteMask & (1u << offset))) {
+                value |= static_cast<uint32_t>(entry.data[offset]) << (8 * b);
+                forwardedMask |= 1u << b;
+                break;
+            }
+        }
+    }
+
+    uint32_t allBytes = (1u << size) - 1;
+    if (forwardedMask == allBytes) {
+        forwardedLoads++;
+        return value;
+    }
+
+    uint32_t memoryValue = readBelow(address, tickCounter, size, pc);
+    if (forwardedMask != 0) {
+        partialForwards++;
+    }
+    for (uint32_t b = 0; b < size; b++) {
+        if (!(forwardedMask & (1u << b))) {
+            value |= memoryValue & (0xFFu << (8 * b));
+        }
+    }
+    return value;
+}
+
+// Load from RAM, through the prefetch unit when one is attached
+uint32_t StoreBuffer::readBelow(uint32_t address, uint64_t& tickCounter, uint32_t size, uint32_t pc) {
+    if (prefetchUnit != nullptr) {
+        return prefetchUnit->read(pc, address, tickCounter, size);
+    }
+    return ram.read(address, tickCounter, size);
+}
+
+// Push every pending line to RAM and wait for the last one
+void StoreBuffer::drain(uint64_t& tickCounter) {
+    if (count == 0) {
+        return;
+    }
+    close(count - 1, tickCounter);
+    tickCounter = std::max(tickCounter, lastDoneTick);
+    retire(tickCounter);
+}
+
+// Between quanta: everything buffered goes out to RAM at once
+void StoreBuffer::publish(uint64_t now) {
+    if (count == 0) {
+        return;
+    }
+    close(count - 1, now);
+    retire(lastDoneTick);
+}
+
+// Line writes go out one at a time in buffer order, so closing an entry closes every older one
+void StoreBuffer::close(int index, uint64_t now) {
+    for (int i = 0; i <= index; i++) {
+        Entry& entry = entryAt(i);
+        if (!entry.open) continue;
+        entry.open = false;
+        entry.startTick = std::max(now, lastDoneTick);
+        entry.doneTick = entry.startTick + RAM::WRITE_LATENCY;
+        lastDoneTick = entry.doneTick;
+    }
+}
+
+// Write completed entries into RAM, oldest first. An idle entry closes at the tick it became
+// due rather than at now, so a store is never held back waiting for a later access.
+void StoreBuffer::retire(uint64_t now) {
+    for (int i = 0; i < count; i++) {
+        const Entry& entry = entryAt(i);
+        if (entry.open && entry.lastStoreTick + CLOSE_TICKS <= now) {
+            close(i, entry.lastStoreTick + CLOSE_TICKS);
+        }
+    }
+    while (count > 0 && !entryAt(0).open && entryAt(0).doneTick <= now) {
+        Entry& entry = entryAt(0);
+        uint64_t backgroundTicks = 0;    // The drain runs off the critical path
+        ram.writeLine(entry.lineAddress, entry.data, entry.byteMask, backgroundTicks);
+        lineWrites++;
+        head = (head + 1) % MAX_DEPTH;
+        count--;
+    }
+}
+
+// Print buffer statistics
+void StoreBuffer::printStatistics() const {
+    std::cout << "Store buffer (depth " << depth << "): stores " << stores
+              << ", coalesced " << coalesced
+              << ", line writes " << lineWrites
+              << ", forwarded loads " << forwardedLoads
+              << ", partial forwards " << partialForwards
+              << ", full stalls " << fullStalls
+              << " (" << stallTicks << " ticks)" << std::endl;
+}
@@ -0,0 +1,82 @@
+// store_buffer.h
+#ifndef STORE_BUFFER_H
+#define STORE_BUFFER_H
+
+#include "ram.h"
+#include "prefetcher.h"
+#include <cstdint>
+
+// Non-blocking store buffer in front of RAM. Stores are collected into line-sized
+// entries and written back in the background, one line write per RAM access; the
+// caller only stalls when every entry is occupied. Loads are forwarded from the buffer.
+// An entry keeps merging stores until it has to be written: a new line needs its slot,
+// a fence / atomic / drain empties the buffer, the line is complete and the stores have
+// moved on to another line, or CLOSE_TICKS have passed since its last store.
+class StoreBuffer {
+public:
+    static const int MAX_DEPTH = 16;
+    static const int DEFAULT_DEPTH = 4;
+    static const uint64_t CLOSE_TICKS = 200;    // An entry no store merged into for this long is written back
+
+    // depth 0 disables buffering: stores go straight to RAM::write
+    StoreBuffer(RAM& ram, int depth = DEFAULT_DEPTH);
+
+    // Buffer a store issued at tick tickCounter; adds the stall time when the buffer is full
+    void write(uint32_t address, uint32_t value, uint64_t& tickCounter, uint32_t size = 4);
+
+    // Load at tick tickCounter, forwarding buffered bytes; pays RAM latency unless fully forwarded.
+    // pc identifies the load for the prefetcher.
+    uint32_t read(uint32_t address, uint64_t& tickCounter, uint32_t size = 4, uint32_t pc = 0);
+
+    // Route loads that miss the buffer through a prefetch unit instead of straight to RAM
+    void attachPrefetcher(PrefetchUnit* unit) { prefetchUnit = unit; }
+
+    // Wait for every buffered store to reach RAM (fence / end of simulation)
+    void drain(uint64_t& tickCounter);
+
+    // End of a quantum of a multi-core run at tick now: schedule every open entry and write all
+    // of them to RAM, so the other harts see these stores from the next quantum on. The line
+    // writes keep their slots on the port; the core does not wait for them.
+    void publish(uint64_t now);
+
+    // Print buffer statistics
+    void printStatistics() const;
+
+    uint64_t stores = 0;            // Stores accepted
+    uint64_t coalesced = 0;         // Stores merged into an existing entry
+    uint64_t lineWrites = 0;        // Line writes sent to RAM
+    uint64_t forwardedLoads = 0;    // Loads served entirely from the buffer
+    uint64_t partialForwards = 0;   // Loads that merged buffered bytes with RAM data
+    uint64_t fullStalls = 0;        // Stores that found the buffer full
+    uint64_t stallTicks = 0;        // Ticks spent waiting for a free entry
+
+private:
+    struct Entry {
+        uint32_t lineAddress;
+        uint32_t byteMask;
+        bool open;                  // Still merging stores; its line write is not scheduled yet
+        uint64_t lastStoreTick;     // Tick of the latest store merged in, while open
+        uint64_t startTick;         // Tick the line write to RAM begins, once closed
+        uint64_t doneTick;          // Tick the line write completes and the entry frees up
+        uint8_t data[RAM::LINE_SIZE];
+    };
+
+    RAM& ram;
+    PrefetchUnit* prefetchUnit = nullptr;
+    int depth;
+    Entry entries[MAX_DEPTH];       // Circular queue, oldest at head
+    int head = 0;
+    int count = 0;
+    uint64_t lastDoneTick = 0;      // Completion of the youngest scheduled line write
+
+    // Read from the level below the buffer
+    uint32_t readBelow(uint32_t address, uint64_t& tickCounter, uint32_t size, uint32_t pc);
+    // Close the entries left idle for CLOSE_TICKS, then write back every entry whose line
+    // write has completed by tick now
+    void retire(uint64_t now);
+    // Close the entries up to and including index and schedule their line writes in order
+    void close(int index, uint64_t now);
+    Entry& entryAt(int index) { return entries[(head + index) % MAX_DEPTH]; }
+};
+
+#endif // STORE_BUFFER_H
@@ -1,40 +1,578 @@
-// main.cpp
-#include "ram.cpp"
+// testing.cpp
+// Checks of the memory hierarchy timing models (RAM, store buffer and prefetch unit), the memory
+// trace format, the assembler, and the fast interpreter against the cycle-level core.
+// Build: g++ -g testing.cpp ram.cpp store_buffer.cpp prefetcher.cpp mem_trace.cpp assembler.cpp core.cpp
+//        interpreter.cpp profiler.cpp host_profile.cpp -o testing
+#include "ram.h"
+#include "store_buffer.h"
+#include "prefetcher.h"
+#include "mem_trace.h"
+#include "assembler.h"
+#include "core.h"
+#include "interpreter.h"
+#include <cassert>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
+#include <vector>
 
-int main() {
-    // Instantiate the RAM object
+// Plain RAM accesses pay the full latency
+static void testRam() {
+    RAM ram;
+    uint64_t tickCounter = 0;
+    ram.write(0x004, 0xDEADBEEF, tickCounter);
+    assert(tickCounter == RAM::WRITE_LATENCY);
+    assert(ram.read(0x004, tickCounter) == 0xDEADBEEF);
+    assert(tickCounter == RAM::WRITE_LATENCY + RAM::READ_LATENCY);
+    assert(ram.read(0x004, tickCounter, 1) == 0xEF);
+}
+
+// sc.w fails after any store to the reserved line, even one that leaves the word's value as it was
+static void testReservation() {
+    RAM ram;
+    uint64_t tickCounter = 0;
+    uint32_t reservation;
+    uint32_t value = ram.loadReserved(0xC00, reservation, tickCounter);
+    assert(ram.storeConditional(0xC00, value + 1, reservation, tickCounter));
+    assert(ram.read(0xC00, tickCounter) == value + 1);
+
+    value = ram.loadReserved(0xC00, reservation, tickCounter);
+    ram.write(0xC00, value + 2, tickCounter);
+    ram.write(0xC00, value, tickCounter);
+    assert(!ram.storeConditional(0xC00, value + 3, reservation, tickCounter));
+    assert(ram.read(0xC00, tickCounter) == value);
+
+    value = ram.loadReserved(0xC00, reservation, tickCounter);
+    ram.write(0xC0C, 1, tickCounter);
+    assert(!ram.storeConditional(0xC00, value + 3, reservation, tickCounter));
+}
+
+// A load of buffered bytes is served from the buffer without touching RAM
+static void testForwarding() {
+    RAM ram;
+    StoreBuffer buffer(ram, 2);
+    uint64_t tickCounter = 0;
+    buffer.write(0xC04, 0x12345678, tickCounter);
+    assert(tickCounter == 0);
+    assert(buffer.read(0xC04, tickCounter) == 0x12345678);
+    assert(buffer.read(0xC06, tickCounter, 2) == 0x1234);
+    assert(tickCounter == 0);
+    assert(buffer.forwardedLoads == 2);
+    assert(buffer.partialForwards == 0);
+}
+
+// Buffered bytes are merged with the rest of the word from RAM, which costs a RAM read
+static void testPartialForward() {
+    RAM ram;
+    uint64_t ramTicks = 0;
+    ram.write(0xC10, 0x11223344, ramTicks);
+
+    StoreBuffer buffer(ram, 2);
+    uint64_t tickCounter = 0;
+    buffer.write(0xC10, 0xAA, tickCounter, 1);
+    assert(buffer.read(0xC10, tickCounter) == 0x112233AA);
+    assert(tickCounter == RAM::READ_LATENCY);
+    assert(buffer.partialForwards == 1);
+    assert(buffer.forwardedLoads == 0);
+}
+
+// A store to a new line with every entry taken waits for the oldest line write
+static void testFullStall() {
+    RAM ram;
+    StoreBuffer buffer(ram, 2);
+    uint64_t tickCounter = 0;
+    buffer.write(0xC00, 1, tickCounter);
+    buffer.write(0xC10, 2, tickCounter);
+    assert(tickCounter == 0);
+    assert(buffer.fullStalls == 0);
+
+    buffer.write(0xC20, 3, tickCounter);
+    assert(buffer.fullStalls == 1);
+    assert(buffer.stallTicks == RAM::WRITE_LATENCY);
+    assert(tickCounter == RAM::WRITE_LATENCY);
+    assert(buffer.lineWrites == 1);
+    assert(ram.read(0xC00, tickCounter) == 1);
+
+    buffer.drain(tickCounter);
+    assert(buffer.lineWrites == 3);
+    assert(ram.read(0xC20, tickCounter) == 3);
+}
+
+// Stores to one line merge into one line write as long as each comes within CLOSE_TICKS of the
+// one before
+static void testCoalescing() {
+    RAM ram;
+    StoreBuffer buffer(ram, 2);
+    uint64_t tickCounter = 0;
+    for (uint32_t i = 0; i < 4; i++) {
+        buffer.write(0xC00 + 4 * i, 0x1000 + i, tickCounter);
+        tickCounter += StoreBuffer::CLOSE_TICKS - 1;
+    }
+    assert(buffer.coalesced == 3);
+    assert(buffer.lineWrites == 0);
+    buffer.drain(tickCounter);
+    assert(buffer.lineWrites == 1);
+    for (uint32_t i = 0; i < 4; i++) {
+        assert(ram.read(0xC00 + 4 * i, tickCounter) == 0x1000 + i);
+    }
+
+    // A streaming loop of word stores a few cycles apart fills each line before moving on:
+    // one line write per line and no stalls
+    StoreBuffer stream(ram, StoreBuffer::DEFAULT_DEPTH);
+    uint64_t streamTicks = 0;
+    const uint32_t STREAM_STORES = 258;
+    for (uint32_t i = 0; i < STREAM_STORES; i++) {
+        stream.write(0x800 + 4 * i, i, streamTicks);
+        streamTicks += 130;
+    }
+    stream.drain(streamTicks);
+    uint32_t wordsPerLine = RAM::LINE_SIZE / 4;
+    assert(stream.lineWrites == (STREAM_STORES + wordsPerLine - 1) / wordsPerLine);
+    assert(stream.fullStalls == 0);
+    assert(ram.read(0x800 + 4 * (STREAM_STORES - 1), streamTicks) == STREAM_STORES - 1);
+}
+
+// A lone store reaches RAM on its own once its entry has been idle for CLOSE_TICKS and the line
+// write is done; any later access writes it back
+static void testIdleClose() {
+    RAM ram;
+    StoreBuffer buffer(ram, 2);
+    uint64_t tickCounter = 0;
+    buffer.write(0xC00, 7, tickCounter);
+    tickCounter = StoreBuffer::CLOSE_TICKS + RAM::WRITE_LATENCY - 1;
+    buffer.read(0xD00, tickCounter);
+    assert(buffer.lineWrites == 0);
+    buffer.read(0xD00, tickCounter);
+    assert(buffer.lineWrites == 1);
+    assert(buffer.coalesced == 0);
+    buffer.write(0xC04, 8, tickCounter);     // Too late to merge: a new entry
+    assert(buffer.coalesced == 0);
+}
+
+// Two harts, each with its own store buffer on the shared RAM, run a flag handshake: each sets
+// its flag with a plain store, then spins on the other's with plain loads. Both have to see the
+// other's flag without a fence, and within a bounded time.
+static void testFlagHandshake() {
+    RAM ram;
+    ram.setShared(true);
+    StoreBuffer buffers[2] = { StoreBuffer(ram), StoreBuffer(ram) };
+    uint64_t ticks[2] = { 0, 0 };
+    const uint32_t flags[2] = { 0xC00, 0xC40 };
+    bool seen[2] = { false, false };
+    for (int hart = 0; hart < 2; hart++) {
+        buffers[hart].write(flags[hart], 1, ticks[hart]);
+        ticks[hart] += 10;
+    }
+    int iterations = 0;
+    while (!(seen[0] && seen[1])) {
+        assert(++iterations < 100);
+        for (int hart = 0; hart < 2; hart++) {
+            if (!seen[hart]) {
+                seen[hart] = buffers[hart].read(flags[1 - hart], ticks[hart]) == 1;
+                ticks[hart] += 10;
+            }
+        }
+    }
+    for (int hart = 0; hart < 2; hart++) {
+        assert(ticks[hart] < StoreBuffer::CLOSE_TICKS + 10 * RAM::READ_LATENCY);
+    }
+}
+
+// Next-line prefetches: a line that has arrived is free, one still on its way costs the rest of
+// the wait, and with demand fill the line a miss fetched serves later loads to it
+static void testPrefetchTiming() {
+    RAM ram;
+    PrefetchConfig config;
+    PrefetchUnit unit(ram, PrefetchUnit::create("next", config), true);
+
+    uint64_t tickCounter = 0;
+    unit.read(0, 0x400, tickCounter);      // Miss, prefetches 0x410 ready at tick 20
+    assert(unit.misses == 1);
+    assert(tickCounter == RAM::READ_LATENCY);
+
+    unit.read(0, 0x404, tickCounter);
+    assert(unit.lineHits == 1);
+    assert(tickCounter == RAM::READ_LATENCY);
+
+    unit.read(0, 0x410, tickCounter);      // Timely, prefetches 0x420 ready at tick 40
+    assert(unit.timelyHits == 1);
+    assert(tickCounter == RAM::READ_LATENCY);
+
+    tickCounter += 5;
+    unit.read(0, 0x420, tickCounter);      // Late: waits out the remaining 15 ticks
+    assert(unit.lateHits == 1);
+    assert(tickCounter == 2 * RAM::READ_LATENCY);
+    assert(unit.useful == 2);
+    assert(unit.ticksSaved == RAM::READ_LATENCY + 5);
+}
+
+// Without demand fill only prefetched lines are kept, so the "none" baseline and a prefetcher
+// differ by the prefetches alone; with it, "none" is a plain line buffer
+static void testDemandFill() {
     RAM ram;
+    PrefetchConfig config;
+    PrefetchUnit plain(ram, PrefetchUnit::create("none", config));
+    uint64_t tickCounter = 0;
+    plain.read(0, 0x400, tickCounter);
+    plain.read(0, 0x404, tickCounter);
+    assert(plain.misses == 2);
+    assert(plain.lineHits == 0);
+    assert(tickCounter == 2 * RAM::READ_LATENCY);
+
+    PrefetchUnit filled(ram, PrefetchUnit::create("none", config), true);
+    tickCounter = 0;
+    filled.read(0, 0x400, tickCounter);
+    filled.read(0, 0x404, tickCounter);
+    assert(filled.misses == 1);
+    assert(filled.lineHits == 1);
+    assert(filled.issued == 0);
+    assert(tickCounter == RAM::READ_LATENCY);
+}
+
+// The stride prefetcher's distance counts lines: a 4-byte stride with distance 1 asks for the
+// same offset in the next line, and each degree step adds a line
+static void testStrideDistance() {
+    PrefetchConfig config;
+    config.degree = 2;
+    StridePrefetcher prefetcher(config);
+    std::vector<uint32_t> candidates;
+    prefetcher.observe(0x40, 0x400, candidates);
+    prefetcher.observe(0x40, 0x404, candidates);
+    assert(candidates.empty());
+    prefetcher.observe(0x40, 0x408, candidates);
+    assert(candidates.size() == 2);
+    assert(candidates[0] == 0x408 + RAM::LINE_SIZE);
+    assert(candidates[1] == 0x408 + 2 * RAM::LINE_SIZE);
+
+    // Strides longer than the distance stay on the stride
+    candidates.clear();
+    for (uint32_t address = 0x400; address <= 0x4C0; address += 0x40) {
+        prefetcher.observe(0x80, address, candidates);
+    }
+    assert(!candidates.empty());
+    assert(candidates[candidates.size() - 2] == 0x4C0 + 0x40);
+    assert(candidates[candidates.size() - 1] == 0x4C0 + 0x80);
+}
+
+// Records captured from two harts survive the delta / varint encoding unchanged: mixed reads,
+// writes, atomics and fences of every size, and jumps in address, pc and tick far beyond what
+// one varint byte holds, in both directions
+static void testTraceRoundTrip() {
+    TraceCapture captures[2] = { TraceCapture(0), TraceCapture(1) };
+    const struct {
+        int hart;
+        uint64_t tick;
+        uint32_t pc;
+        uint32_t address;
+        int size;
+        MemoryAccess access;
+    } accesses[] = {
+        { 0, 0, 0x0000, 0x0000, 4, ACCESS_READ },
+        { 0, 10, 0x0004, 0x13FC, 4, ACCESS_WRITE },          // Across the whole RAM
+        { 1, 10, 0x0100, 0x0800, 2, ACCESS_READ },
+        { 0, 20, 0x0008, 0x0004, 1, ACCESS_WRITE },          // And back
+        { 1, 30, 0x0104, 0x0802, 1, ACCESS_WRITE },
+        { 1, 40, 0x0108, 0, 0, ACCESS_FENCE },
+        { 0, 1ull << 40, 0xFFFFFFFC, 0xFFFFFFF0, 4, ACCESS_ATOMIC },   // Far jumps in tick, pc, address
+        { 1, (1ull << 40) + 5, 0x010C, 0x0C00, 4, ACCESS_READ },
+        { 0, (1ull << 40) + 10, 0x0000, 0x0010, 2, ACCESS_WRITE },
+        { 0, (1ull << 40) + 10, 0x0004, 0x0010, 2, ACCESS_READ },      // Same tick: order kept
+    };
+    std::vector<TraceRecord> records;
+    for (const auto& access : accesses) {
+        MemoryEvent event = { access.tick / 10, access.tick, access.pc, access.address, 0, access.size,
+                              access.access, 0 };
+        TraceCapture& capture = captures[access.hart];
+        capture.on_memory(event);
+        records.push_back(capture.records.back());
+    }
+
+    std::vector<TraceRecord> all = captures[0].records;
+    all.insert(all.end(), captures[1].records.begin(), captures[1].records.end());
+    const char* path = "testing_trace.bin";
+    assert(writeTrace(path, all));
+    std::vector<TraceRecord> decoded;
+    bool read = readTrace(path, decoded);
+    std::remove(path);
+    assert(read);
+
+    assert(decoded.size() == records.size());
+    for (size_t i = 0; i < records.size(); i++) {
+        assert(decoded[i].tick == records[i].tick);
+        assert(decoded[i].address == records[i].address);
+        assert(decoded[i].pc == records[i].pc);
+        assert(decoded[i].core == records[i].core);
+        assert(decoded[i].size == records[i].size);
+        assert(decoded[i].access == records[i].access);
+    }
+}
+
+// Little-endian word of an assembled image, and the immediates of the instruction formats
+static uint32_t wordAt(const uint8_t* memory, uint32_t address) {
+    uint32_t word;
+    std::memcpy(&word, memory + address, sizeof(word));
+    return word;
+}
+
+static int32_t immI(uint32_t word) { return static_cast<int32_t>(word) >> 20; }
+static int32_t immU(uint32_t word) { return static_cast<int32_t>(word & 0xFFFFF000u); }
+
+static int32_t immB(uint32_t word) {
+    return (static_cast<int32_t>(word) >> 31 << 12) | (word >> 7 & 0x1) << 11 | (word >> 25 & 0x3F) << 5 |
+           (word >> 8 & 0xF) << 1;
+}
+
+static int32_t immJ(uint32_t word) {
+    return (static_cast<int32_t>(word) >> 31 << 20) | (word >> 12 & 0xFF) << 12 | (word >> 20 & 0x1) << 11 |
+           (word >> 21 & 0x3FF) << 1;
+}
 
-    // Simulation tick counter
-    int tickCounter = 0;
+// Instruction encodings against llvm-mc -triple=riscv32 -mattr=+f,+a; ';' separates statements
+static void testAssemblerEncodings() {
+    const char* source =
+        "\taddi a0, zero, 1\n"
+        "\tadd a0, a1, a2\n"
+        "\tsub t0, t1, t2\n"
+        "\tlw a1, 8(a0)\n"
+        "\tsw a1, -12(sp)\n"
+        "\tlui a0, 0x12345\n"
+        "\tslli t0, a0, 6\n"
+        "\tfadd.s ft0, ft1, ft2\n"
+        "\tflw ft0, 4(a2)\n"
+        "\tfsw ft1, -8(a2)\n"
+        "\tfmadd.s ft0, ft1, ft2, ft3\n"
+        "\tamoadd.w.aqrl zero, t1, (t0)\n"
+        "\tlr.w t1, (t0)\n"
+        "\tsc.w t2, t1, (t0)\n"
+        "\tfence rw, w\n"
+        "\tret\n"
+        "\taddi a0, zero, 1; addi a0, a0, 2   # both statements, then a comment\n";
+    const uint32_t expected[] = {
+        0x00100513, 0x00C58533, 0x407302B3, 0x00852583, 0xFEB12A23, 0x12345537, 0x00651293, 0x0020F053,
+        0x00462007, 0xFE162C27, 0x1820F043, 0x0662A02F, 0x1002A32F, 0x1862A3AF, 0x0310000F, 0x00008067,
+        0x00100513, 0x00250513,
+    };
+    const uint32_t count = sizeof(expected) / sizeof(expected[0]);
+    uint8_t memory[0x200] = {};
+    Assembler assembler(memory, sizeof(memory));
+    assert(assembler.assemble(source, 0));
+    assert(assembler.textEnd() == 4 * count);
+    for (uint32_t i = 0; i < count; i++) {
+        assert(wordAt(memory, 4 * i) == expected[i]);
+    }
+}
+
+// Branches and jumps resolve backwards and forwards; %hi / %lo carry into the upper part when the
+// low part is negative; %pcrel_lo accepts both the auipc's label and the target symbol
+static void testAssemblerLabels() {
+    const char* source =
+        "\t.text\n"
+        "start:\taddi t0, zero, 3\n"              // 0x17F0
+        "loop:\taddi t0, t0, -1\n"
+        "\tbnez t0, loop\n"                       // 0x17F8
+        "\tbeq t0, zero, done\n"                  // 0x17FC
+        "\tnop\n"
+        "done:\tlui a0, %hi(value)\n"             // 0x1804
+        "\tlw a1, %lo(value)(a0)\n"
+        "here:\tauipc a2, %pcrel_hi(value)\n"     // 0x180C
+        "\taddi a2, a2, %pcrel_lo(here)\n"
+        "\tla a3, value\n"                        // 0x1814
+        "\tjal ra, start\n"                       // 0x181C
+        "\t.data\n"
+        "value:\t.word 0x12345678, start\n";
+    const uint32_t base = 0x17F0;
+    const uint32_t value = 0x1820;
+    uint8_t memory[0x2000] = {};
+    Assembler assembler(memory, sizeof(memory));
+    assert(assembler.assemble(source, base));
+    assert(assembler.symbols().at("value") == value);
+    assert(assembler.dataStart() == value);
+
+    uint32_t bnez = wordAt(memory, 0x17F8);
+    assert((bnez & 0x707F) == 0x1063 && immB(bnez) == -4);
+    uint32_t beq = wordAt(memory, 0x17FC);
+    assert((beq & 0x707F) == 0x0063 && immB(beq) == 8);
+
+    uint32_t lui = wordAt(memory, 0x1804);
+    uint32_t lw = wordAt(memory, 0x1808);
+    assert(immU(lui) == 0x2000 && immI(lw) < 0);
+    assert(static_cast<uint32_t>(immU(lui) + immI(lw)) == value);
+
+    assert(static_cast<uint32_t>(0x180C + immU(wordAt(memory, 0x180C)) + immI(wordAt(memory, 0x1810))) == value);
+    assert(static_cast<uint32_t>(0x1814 + immU(wordAt(memory, 0x1814)) + immI(wordAt(memory, 0x1818))) == value);
+
+    uint32_t jal = wordAt(memory, 0x181C);
+    assert((jal & 0xFFF) == 0x0EF && immJ(jal) == static_cast<int32_t>(base) - 0x181C);
+
+    assert(wordAt(memory, value) == 0x12345678);
+    assert(wordAt(memory, value + 4) == base);
+}
+
+// Data directives, and alignment that holds in memory: .data starts at a multiple of its
+// largest .align, and padding is written as zeros
+static void testAssemblerData() {
+    const char* source =
+        "\t.text\n"
+        "\tnop\n"
+        "\t.data\n"
+        "\t.equ COUNT, 3\n"
+        "bytes:\t.byte 1, 2, COUNT\n"              // 0x08
+        "\t.balign 2\n"
+        "half:\t.half 0xBEEF, -2\n"                // 0x0C
+        "\t.byte 7\n"
+        "\t.align 3\n"
+        "dword:\t.word -1, bytes + 1\n"            // 0x18
+        "fl:\t.float 1.5\n"
+        "pad:\t.space 5, 0xAA\n"                   // 0x24
+        "\t.balign 4\n"
+        "last:\t.word last\n";                     // 0x2C
+    uint8_t memory[0x100];
+    std::memset(memory, 0x55, sizeof(memory));
+    Assembler assembler(memory, sizeof(memory));
+    assert(assembler.assemble(source, 0));
+    assert(assembler.dataStart() == 0x08);
+    assert(assembler.dataEnd() == 0x30);
+    assert(assembler.symbols().at("half") == 0x0C);
+    assert(assembler.symbols().at("dword") == 0x18);
+    assert(assembler.symbols().at("last") == 0x2C);
 
-    // Test writing a value to RAM
-    uint32_t testAddress = 0x004;  // Some arbitrary address within bounds
-    uint32_t testValue = 0xDEADBEEF;
-    std::cout << "Writing 0x" << std::hex << testValue << " to address 0x" << testAddress << std::dec << std::endl;
-    ram.write(testAddress, testValue, tickCounter);
+    assert(memory[0x08] == 1 && memory[0x09] == 2 && memory[0x0A] == 3 && memory[0x0B] == 0);
+    assert(wordAt(memory, 0x0C) == 0xFFFEBEEF);
+    assert(memory[0x10] == 7);
+    for (uint32_t address = 0x11; address < 0x18; address++) {
+        assert(memory[address] == 0);
+    }
+    assert(wordAt(memory, 0x18) == 0xFFFFFFFF);
+    assert(wordAt(memory, 0x1C) == 0x09);
+    assert(wordAt(memory, 0x20) == 0x3FC00000);
+    for (uint32_t address = 0x24; address < 0x29; address++) {
+        assert(memory[address] == 0xAA);
+    }
+    assert(memory[0x29] == 0 && memory[0x2B] == 0);
+    assert(wordAt(memory, 0x2C) == 0x2C);
+}
 
-    // Print tick count after write
-    std::cout << "Ticks after write: " << tickCounter << std::endl;
+// A loop over every idiom the interpreter fuses (lui + addi, slli + add, lui + load, addi +
+// branch), with FP arithmetic, stores and an amo
+static const char* const FUSION_PROGRAM =
+    "\t.text\n"
+    "main:\tlui a4, %hi(values)\n"
+    "\taddi a4, a4, %lo(values)\n"
+    "\tli t0, 0\n"
+    "\tli t1, 8\n"
+    "\tfmv.w.x ft2, zero\n"
+    "loop:\tslli t2, t0, 2\n"
+    "\tadd t3, a4, t2\n"
+    "\tlw t4, 0(t3)\n"
+    "\tadd a0, a0, t4\n"
+    "\tfcvt.s.w ft0, t4\n"
+    "\tfadd.s ft2, ft2, ft0\n"
+    "\tfmul.s ft1, ft0, ft0\n"
+    "\tfsw ft1, 32(t3)\n"
+    "\tlui t5, %hi(total)\n"
+    "\tlw t6, %lo(total)(t5)\n"
+    "\tadd t6, t6, t4\n"
+    "\tsw t6, %lo(total)(t5)\n"
+    "\taddi t0, t0, 1\n"
+    "\tblt t0, t1, loop\n"
+    "\tla t0, total\n"
+    "\tli t1, 5\n"
+    "\tamoadd.w a1, t1, (t0)\n"
+    "\tfsw ft2, 4(t0)\n"
+    "\tret\n"
+    "\t.data\n"
+    "values:\t.word 3, -1, 4, 1, -5, 9, 2, -6\n"
+    "squares:\t.space 32\n"
+    "total:\t.word 0, 0\n";
 
-    // Test reading the value back from RAM
-    uint32_t readValue = ram.read(testAddress, tickCounter);
-    std::cout << "Read value 0x" << std::hex << readValue << " from address 0x" << testAddress << std::dec << std::endl;
+// Self-modifying code: after the first pass the loop rewrites the addi of its fused lui + addi
+// pair (to addi a1, a1, 100), so the interpreter has to invalidate and re-fuse the pair. The fence
+// drains the core's store buffer before the next fetch of the patched word.
+static const char* const PATCH_PROGRAM =
+    "\t.text\n"
+    "main:\tli t0, 2\n"
+    "\tli a0, 0\n"
+    "\tla t1, patch\n"
+    "\tli t2, 0x06458593\n"
+    "loop:\tlui a1, 1\n"
+    "patch:\taddi a1, a1, 1\n"
+    "\tadd a0, a0, a1\n"
+    "\tsw t2, 0(t1)\n"
+    "\tfence\n"
+    "\taddi t0, t0, -1\n"
+    "\tbnez t0, loop\n"
+    "\tret\n";
 
-    // Print tick count after read
-    std::cout << "Ticks after read: " << tickCounter << std::endl;
+const uint32_t TEST_STACK_TOP = 0x1000;
 
-    // Print a memory range for debugging (adjust start and end as needed)
-    std::cout << "\nMemory dump from 0x000 to 0x010:" << std::endl;
-    ram.print(0x000, 0x010);
+// Run image on a buffered 2-wide core, with or without fusion, and compare its registers and RAM
+// with what the interpreter left
+static void checkCoreMatches(bool fusion, const RAM& image, uint32_t codeEnd, const Interpreter& interpreter,
+                             const RAM& interpreted) {
+    RAM ram;
+    std::memcpy(ram.raw(), image.raw(), RAM::RAM_SIZE);
+    StoreBuffer buffer(ram);
+    CoreSetup setup = { &ram, &buffer, nullptr, nullptr, codeEnd, TEST_STACK_TOP, {} };
+    const CorePreset* preset = find_core_preset(2, false, true, true, true, fusion);
+    assert(preset);
+    CoreModel* core = preset->create(setup);
+    while (!core->done()) {
+        core->step(1000);
+    }
+    uint64_t ticks = core->ticks();
+    buffer.drain(ticks);
 
-    // Test the initialized random floating-point arrays
-    std::cout << "\nMemory dump of ARRAY_A (0x400 to 0x420):" << std::endl;
-    ram.print(0x400, 0x420);
+    for (int i = 0; i < NUM_REGISTERS; i++) {
+        assert(core->int_regs[i] == interpreter.intRegs[i]);
+        assert(std::memcmp(&core->fp_regs[i], &interpreter.fpRegs[i], sizeof(float)) == 0);
+    }
+    assert(std::memcmp(ram.raw(), interpreted.raw(), RAM::RAM_SIZE) == 0);
+    delete core;
+}
 
-    std::cout << "\nMemory dump of ARRAY_B (0x800 to 0x820):" << std::endl;
-    ram.print(0x800, 0x820);
+// The interpreter (always fusing) leaves the same state as the core with fusion on and off;
+// returns the interpreter's a0
+static uint32_t checkInterpreterMatchesCore(const char* source) {
+    RAM image;
+    Assembler assembler(image.raw(), RAM::RAM_SIZE);
+    assert(assembler.assemble(source, 0));
+    uint32_t codeEnd = assembler.textEnd();
 
+    RAM interpreted;
+    std::memcpy(interpreted.raw(), image.raw(), RAM::RAM_SIZE);
+    Interpreter interpreter(interpreted, 0, codeEnd);
+    interpreter.intRegs[1] = codeEnd;           // ra: returning from main ends the run
+    interpreter.intRegs[2] = TEST_STACK_TOP;    // sp
+    interpreter.intRegs[11] = 1;                // a1: one hart
+    interpreter.run(0);
+
+    checkCoreMatches(false, image, codeEnd, interpreter, interpreted);
+    checkCoreMatches(true, image, codeEnd, interpreter, interpreted);
+    return interpreter.intRegs[10];
+}
+
+static void testInterpreterMatchesCore() {
+    assert(checkInterpreterMatchesCore(FUSION_PROGRAM) == 7);
+    assert(checkInterpreterMatchesCore(PATCH_PROGRAM) == 0x1001 + 0x1064);
+}
+
+int main() {
+    testRam();
+    testReservation();
+    testForwarding();
+    testPartialForward();
+    testFullStall();
+    testCoalescing();
+    testIdleClose();
+    testFlagHandshake();
+    testPrefetchTiming();
+    testDemandFill();
+    testStrideDistance();
+    testTraceRoundTrip();
+    testAssemblerEncodings();
+    testAssemblerLabels();
+    testAssemblerData();
+    testInterpreterMatchesCore();
+    std::cout << "All tests passed" << std::endl;
     return 0;
 }
@@ -0,0 +1,51 @@
+# Vector add C = A + B (256 floats at 0x400 / 0x800 / 0xC00) split across the harts of a
+# multi-core run (simulator -c N). Each hart gets its hart id in a0 and the number of harts
+# in a1, adds every a1-th block of 16 elements starting at block a0, then waits at a barrier
+# until all harts are done. Works unchanged on a single core (a0 = 0, a1 = 1).
+	.text
+main:
+	slli	t0, a0, 6		# Byte offset of this hart's first block
+	slli	t1, a1, 6		# Distance between its blocks
+	li	t2, 1024		# Bytes per array
+	li	a3, 0			# Elements added by this hart
+	li	a4, 2048		# B; A and C are 1 KiB either side
+.Lblock:
+	bge	t0, t2, .Lcount
+	addi	t3, t0, 64		# End of the block
+.Lelement:
+	add	a2, a4, t0		# &B[i]
+	flw	ft0, -1024(a2)
+	flw	ft1, 0(a2)
+	fadd.s	ft0, ft0, ft1
+	fsw	ft0, 1024(a2)
+	addi	a3, a3, 1
+	addi	t0, t0, 4
+	blt	t0, t3, .Lelement
+	add	t0, t0, t1
+	addi	t0, t0, -64
+	j	.Lblock
+
+.Lcount:
+	la	t0, elements		# elements += a3 with an lr / sc retry loop
+.Lretry:
+	lr.w	t1, (t0)
+	add	t1, t1, a3
+	sc.w	t2, t1, (t0)
+	bnez	t2, .Lretry
+
+	la	t0, arrived		# Barrier: count this hart in, then wait for the rest
+	li	t1, 1
+	amoadd.w.aqrl	zero, t1, (t0)
+.Lwait:
+	lr.w	t1, (t0)
+	blt	t1, a1, .Lwait
+
+	la	t0, elements		# Every hart returns the total, 256 when the split was complete
+	lw	a0, 0(t0)
+	ret
+
+	.data
+elements:
+	.word	0
+arrived:
+	.word	0